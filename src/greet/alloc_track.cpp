@@ -0,0 +1,391 @@
+#include "alloc_track.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#if defined(__GLIBC__) || defined(__APPLE__) || defined(__unix__)
+#include <dlfcn.h>
+#define GREET_HAVE_DLADDR 1
+#endif
+#ifdef _WIN32
+#include <intrin.h>
+#include <malloc.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define GREET_RETURN_ADDRESS() __builtin_return_address(0)
+#elif defined(_MSC_VER)
+#define GREET_RETURN_ADDRESS() _ReturnAddress()
+#else
+#define GREET_RETURN_ADDRESS() nullptr
+#endif
+
+// On glibc, malloc and friends are interposed too; the real allocator stays
+// reachable through its __libc_ entry points. operator new calls those
+// directly so that one allocation is never counted twice.
+#if defined(__GLIBC__)
+#define GREET_TRACK_MALLOC 1
+extern "C"
+{
+    void *__libc_malloc(std::size_t size);
+    void *__libc_calloc(std::size_t count, std::size_t size);
+    void *__libc_realloc(void *p, std::size_t size);
+    void *__libc_memalign(std::size_t alignment, std::size_t size);
+    void *__libc_valloc(std::size_t size);
+    void *__libc_pvalloc(std::size_t size);
+    void __libc_free(void *p);
+}
+#endif
+
+namespace
+{
+// Zero-initialised at load time, before any constructor can allocate.
+std::atomic<std::uint64_t> g_allocations{0};
+std::atomic<std::uint64_t> g_deallocations{0};
+std::atomic<std::uint64_t> g_bytes{0};
+thread_local AllocationStats t_stats;
+
+struct Site
+{
+    std::atomic<std::uintptr_t> address{0};
+    std::atomic<std::uint64_t> allocations{0};
+    std::atomic<std::uint64_t> bytes{0};
+};
+
+constexpr std::size_t kSites = 4096; // power of two
+constexpr std::size_t kMaxProbes = 32;
+Site g_sites[kSites];
+std::atomic<bool> g_track_sites{false};
+
+void record_site(const void *caller, std::size_t size)
+{
+    auto address = reinterpret_cast<std::uintptr_t>(caller);
+    if (address == 0)
+        return;
+    std::size_t slot = (address * 0x9E3779B97F4A7C15ull) >> 52;
+    for (std::size_t probe = 0; probe < kMaxProbes; ++probe)
+    {
+        Site &site = g_sites[(slot + probe) & (kSites - 1)];
+        std::uintptr_t current = site.address.load(std::memory_order_relaxed);
+        if (current == 0 && site.address.compare_exchange_strong(current, address, std::memory_order_relaxed))
+            current = address;
+        if (current == address)
+        {
+            site.allocations.fetch_add(1, std::memory_order_relaxed);
+            site.bytes.fetch_add(size, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+inline void record_allocation(std::size_t size, const void *caller)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_bytes.fetch_add(size, std::memory_order_relaxed);
+    ++t_stats.allocations;
+    t_stats.bytes += size;
+    if (g_track_sites.load(std::memory_order_relaxed))
+        record_site(caller, size);
+}
+
+inline void record_deallocation(void *p)
+{
+    if (p == nullptr)
+        return;
+    g_deallocations.fetch_add(1, std::memory_order_relaxed);
+    ++t_stats.deallocations;
+}
+
+inline void *raw_allocate(std::size_t size)
+{
+#ifdef GREET_TRACK_MALLOC
+    return __libc_malloc(size ? size : 1);
+#else
+    return std::malloc(size ? size : 1);
+#endif
+}
+
+inline void *raw_allocate_aligned(std::size_t size, std::size_t alignment)
+{
+    if (alignment < sizeof(void *))
+        alignment = sizeof(void *);
+#if defined(GREET_TRACK_MALLOC)
+    return __libc_memalign(alignment, size ? size : 1);
+#elif defined(_WIN32)
+    return _aligned_malloc(size ? size : 1, alignment);
+#else
+    void *p = nullptr;
+    return posix_memalign(&p, alignment, size ? size : 1) == 0 ? p : nullptr;
+#endif
+}
+
+inline void raw_free(void *p)
+{
+#ifdef GREET_TRACK_MALLOC
+    __libc_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+inline void raw_free_aligned(void *p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    raw_free(p);
+#endif
+}
+
+AllocationStats operator-(const AllocationStats &a, const AllocationStats &b)
+{
+    return {a.allocations - b.allocations, a.deallocations - b.deallocations, a.bytes - b.bytes};
+}
+
+std::string describe(const void *address)
+{
+    char text[512];
+#ifdef GREET_HAVE_DLADDR
+    Dl_info info;
+    if (dladdr(address, &info) != 0)
+    {
+        auto offset = [&](const void *base) {
+            return static_cast<unsigned long long>(reinterpret_cast<std::uintptr_t>(address) -
+                                                   reinterpret_cast<std::uintptr_t>(base));
+        };
+        if (info.dli_sname != nullptr)
+            std::snprintf(text, sizeof(text), "%s+0x%llx", info.dli_sname, offset(info.dli_saddr));
+        else
+            std::snprintf(text, sizeof(text), "%s+0x%llx", info.dli_fname, offset(info.dli_fbase));
+        return text;
+    }
+#endif
+    std::snprintf(text, sizeof(text), "%p", address);
+    return text;
+}
+} // namespace
+
+AllocationStats allocation_totals()
+{
+    return {g_allocations.load(std::memory_order_relaxed), g_deallocations.load(std::memory_order_relaxed),
+            g_bytes.load(std::memory_order_relaxed)};
+}
+
+AllocationStats thread_allocation_totals()
+{
+    return t_stats;
+}
+
+AllocationScope::AllocationScope(Threads threads)
+    : threads_(threads), start_(threads == Threads::All ? allocation_totals() : thread_allocation_totals())
+{
+}
+
+AllocationStats AllocationScope::stats() const
+{
+    return (threads_ == Threads::All ? allocation_totals() : thread_allocation_totals()) - start_;
+}
+
+void track_allocation_sites(bool enabled)
+{
+    g_track_sites.store(enabled, std::memory_order_relaxed);
+}
+
+std::vector<AllocationSite> top_allocation_sites(std::size_t limit)
+{
+    std::vector<AllocationSite> sites;
+    for (const Site &site : g_sites)
+    {
+        std::uintptr_t address = site.address.load(std::memory_order_relaxed);
+        if (address == 0)
+            continue;
+        AllocationSite entry;
+        entry.address = reinterpret_cast<const void *>(address);
+        entry.allocations = site.allocations.load(std::memory_order_relaxed);
+        entry.bytes = site.bytes.load(std::memory_order_relaxed);
+        sites.push_back(entry);
+    }
+    std::sort(sites.begin(), sites.end(),
+              [](const AllocationSite &a, const AllocationSite &b) { return a.allocations > b.allocations; });
+    if (sites.size() > limit)
+        sites.resize(limit);
+    for (AllocationSite &site : sites)
+        site.where = describe(site.address);
+    return sites;
+}
+
+// --- Replacement global allocation functions -------------------------------
+
+void *operator new(std::size_t size)
+{
+    record_allocation(size, GREET_RETURN_ADDRESS());
+    if (void *p = raw_allocate(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    record_allocation(size, GREET_RETURN_ADDRESS());
+    if (void *p = raw_allocate(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    record_allocation(size, GREET_RETURN_ADDRESS());
+    return raw_allocate(size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    record_allocation(size, GREET_RETURN_ADDRESS());
+    return raw_allocate(size);
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    record_allocation(size, GREET_RETURN_ADDRESS());
+    if (void *p = raw_allocate_aligned(size, static_cast<std::size_t>(alignment)))
+        return p;
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    record_allocation(size, GREET_RETURN_ADDRESS());
+    if (void *p = raw_allocate_aligned(size, static_cast<std::size_t>(alignment)))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    record_deallocation(p);
+    raw_free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    record_deallocation(p);
+    raw_free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    record_deallocation(p);
+    raw_free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    record_deallocation(p);
+    raw_free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept
+{
+    record_deallocation(p);
+    raw_free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept
+{
+    record_deallocation(p);
+    raw_free(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    record_deallocation(p);
+    raw_free_aligned(p);
+}
+
+void operator delete[](void *p, std::align_val_t) noexcept
+{
+    record_deallocation(p);
+    raw_free_aligned(p);
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept
+{
+    record_deallocation(p);
+    raw_free_aligned(p);
+}
+
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept
+{
+    record_deallocation(p);
+    raw_free_aligned(p);
+}
+
+#ifdef GREET_TRACK_MALLOC
+extern "C"
+{
+    void *malloc(std::size_t size) noexcept
+    {
+        record_allocation(size, GREET_RETURN_ADDRESS());
+        return __libc_malloc(size);
+    }
+
+    void *calloc(std::size_t count, std::size_t size) noexcept
+    {
+        record_allocation(count * size, GREET_RETURN_ADDRESS());
+        return __libc_calloc(count, size);
+    }
+
+    void *realloc(void *p, std::size_t size) noexcept
+    {
+        record_deallocation(p);
+        record_allocation(size, GREET_RETURN_ADDRESS());
+        return __libc_realloc(p, size);
+    }
+
+    void free(void *p) noexcept
+    {
+        record_deallocation(p);
+        __libc_free(p);
+    }
+
+    int posix_memalign(void **out, std::size_t alignment, std::size_t size) noexcept
+    {
+        if (alignment == 0 || (alignment & (alignment - 1)) != 0 || alignment % sizeof(void *) != 0)
+            return EINVAL;
+        record_allocation(size, GREET_RETURN_ADDRESS());
+        void *p = __libc_memalign(alignment, size);
+        if (p == nullptr)
+            return ENOMEM;
+        *out = p;
+        return 0;
+    }
+
+    void *aligned_alloc(std::size_t alignment, std::size_t size) noexcept
+    {
+        record_allocation(size, GREET_RETURN_ADDRESS());
+        return __libc_memalign(alignment, size);
+    }
+
+    void *memalign(std::size_t alignment, std::size_t size) noexcept
+    {
+        record_allocation(size, GREET_RETURN_ADDRESS());
+        return __libc_memalign(alignment, size);
+    }
+
+    void *valloc(std::size_t size) noexcept
+    {
+        record_allocation(size, GREET_RETURN_ADDRESS());
+        return __libc_valloc(size);
+    }
+
+    void *pvalloc(std::size_t size) noexcept
+    {
+        record_allocation(size, GREET_RETURN_ADDRESS());
+        return __libc_pvalloc(size);
+    }
+}
+#endif
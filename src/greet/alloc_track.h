@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Opt-in heap instrumentation for tests and benchmarks. Linking the
+// greet_alloc_track library replaces the global operator new and delete (all
+// forms) and, on glibc, malloc, calloc, realloc, free and the aligned
+// allocators (posix_memalign, aligned_alloc, memalign, valloc, pvalloc) with
+// versions that count calls and bytes, process-wide and per thread. Nothing
+// else in the tree links it, so production builds keep the stock allocator.
+//
+// Counting is a few relaxed atomic adds per call. Attributing allocations to
+// call sites costs a hash-table probe more and is off until enabled.
+
+struct AllocationStats
+{
+    std::uint64_t allocations = 0;
+    std::uint64_t deallocations = 0;
+    std::uint64_t bytes = 0; // requested, including realloc growth
+};
+
+// Totals since the process started, across all threads.
+AllocationStats allocation_totals();
+// Totals for the calling thread since it started.
+AllocationStats thread_allocation_totals();
+
+// Counts the allocations made while it is alive, so a test can assert that a
+// block never reaches the heap:
+//
+//     AllocationScope scope;
+//     writer.write(line);
+//     EXPECT_EQ(scope.allocations(), 0u);
+//
+// By default only the constructing thread is counted, which keeps concurrent
+// test infrastructure out of the numbers; Threads::All counts every thread.
+class AllocationScope
+{
+public:
+    enum class Threads
+    {
+        Current,
+        All
+    };
+
+    explicit AllocationScope(Threads threads = Threads::Current);
+
+    // Counts since construction.
+    AllocationStats stats() const;
+    std::uint64_t allocations() const { return stats().allocations; }
+    std::uint64_t bytes() const { return stats().bytes; }
+
+private:
+    Threads threads_;
+    AllocationStats start_;
+};
+
+// Allocation counts for one call site: the return address of the allocating
+// call, which is the caller of operator new or malloc.
+struct AllocationSite
+{
+    const void *address = nullptr;
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+    std::string where; // symbol or module+offset when known, else the address
+};
+
+// Start or stop attributing allocations to call sites. Up to a few thousand
+// distinct sites are kept; allocations from further sites are only counted in
+// the totals.
+void track_allocation_sites(bool enabled);
+// The `limit` sites with the most allocations so far, busiest first. Builds
+// its result on the heap, so call it outside any scope being measured.
+std::vector<AllocationSite> top_allocation_sites(std::size_t limit);
@@ -0,0 +1,251 @@
+#include "block_output.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "output.h"
+#include "trace.h"
+#ifdef GREET_HAVE_IO_URING
+#include "uring_output.h"
+#endif
+
+#ifndef _WIN32
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+constexpr std::size_t kPageSize = 4096;
+constexpr std::size_t kBlockTarget = 64 * 1024;
+#ifdef IOV_MAX
+constexpr int kMaxIov = IOV_MAX < 512 ? IOV_MAX : 512;
+#else
+constexpr int kMaxIov = 16;
+#endif
+
+// `line` repeated as many times as fits in kBlockTarget (at least once), in a
+// page-aligned buffer. The contents never change after construction, which is
+// what makes handing the pages to vmsplice without SPLICE_F_GIFT safe. On
+// Linux the buffer is its own mapping: pages still queued in a pipe when the
+// block is destroyed stay referenced by the pipe, and the process never reuses
+// them, which a heap buffer would.
+class RepeatedBlock
+{
+public:
+    explicit RepeatedBlock(std::string_view line)
+        : line_size_(line.size()), lines_(std::max<std::size_t>(1, kBlockTarget / line.size()))
+    {
+#ifdef __linux__
+        mapped_size_ = (lines_ * line_size_ + kPageSize - 1) / kPageSize * kPageSize;
+        void *p = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            throw std::system_error(errno, std::generic_category(), "mmap");
+        data_ = static_cast<char *>(p);
+#else
+        storage_.resize(lines_ * line_size_ + kPageSize);
+        void *p = storage_.data();
+        std::size_t space = storage_.size();
+        data_ = static_cast<char *>(std::align(kPageSize, lines_ * line_size_, p, space));
+#endif
+        for (std::size_t i = 0; i < lines_; ++i)
+            std::memcpy(data_ + i * line_size_, line.data(), line_size_);
+    }
+
+    ~RepeatedBlock()
+    {
+#ifdef __linux__
+        munmap(data_, mapped_size_);
+#endif
+    }
+
+    RepeatedBlock(const RepeatedBlock &) = delete;
+    RepeatedBlock &operator=(const RepeatedBlock &) = delete;
+
+    const char *data() const { return data_; }
+    std::size_t lines() const { return lines_; }
+    std::size_t line_size() const { return line_size_; }
+
+private:
+    std::size_t line_size_;
+    std::size_t lines_;
+#ifdef __linux__
+    std::size_t mapped_size_ = 0;
+#else
+    std::vector<char> storage_;
+#endif
+    char *data_ = nullptr;
+};
+
+#ifndef _WIN32
+bool is_pipe(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+}
+
+#ifdef GREET_HAVE_IO_URING
+bool is_regular_file(int fd)
+{
+    struct stat st;
+    return fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+}
+#endif
+
+// Write every byte described by `iov`, advancing through it on short writes.
+void write_iov(int fd, struct iovec *iov, int count, bool splice)
+{
+    GREET_TRACE_SCOPE("write");
+    while (count > 0)
+    {
+#ifdef __linux__
+        ssize_t n = splice ? vmsplice(fd, iov, static_cast<unsigned long>(count), 0) : writev(fd, iov, count);
+#else
+        (void)splice;
+        ssize_t n = writev(fd, iov, count);
+#endif
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), splice ? "vmsplice" : "writev");
+        }
+        std::size_t done = static_cast<std::size_t>(n);
+        while (count > 0 && done >= iov->iov_len)
+        {
+            done -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+            iov->iov_len -= done;
+        }
+    }
+}
+#endif
+} // namespace
+
+OutputBackend parse_output_backend(std::string_view name)
+{
+    for (OutputBackend backend : {OutputBackend::Auto, OutputBackend::Buffered, OutputBackend::Write,
+                                  OutputBackend::Writev, OutputBackend::Vmsplice, OutputBackend::IoUring})
+    {
+        if (name == to_string(backend))
+            return backend;
+    }
+    throw std::invalid_argument("unknown output backend \"" + std::string(name) +
+                                "\" (expected auto, buffered, write, writev, vmsplice or io_uring)");
+}
+
+const char *to_string(OutputBackend backend)
+{
+    switch (backend)
+    {
+    case OutputBackend::Auto:
+        return "auto";
+    case OutputBackend::Buffered:
+        return "buffered";
+    case OutputBackend::Write:
+        return "write";
+    case OutputBackend::Writev:
+        return "writev";
+    case OutputBackend::Vmsplice:
+        return "vmsplice";
+    case OutputBackend::IoUring:
+        return "io_uring";
+    }
+    return "unknown";
+}
+
+OutputBackend resolve_output_backend(int fd, OutputBackend requested)
+{
+#ifdef _WIN32
+    (void)fd;
+    return requested == OutputBackend::Buffered ? requested : OutputBackend::Write;
+#else
+    bool can_splice = false;
+#ifdef __linux__
+    can_splice = is_pipe(fd);
+#endif
+    bool can_uring = false;
+#ifdef GREET_HAVE_IO_URING
+    if (requested == OutputBackend::Auto || requested == OutputBackend::IoUring)
+        can_uring = is_regular_file(fd) && uring_available();
+#endif
+    switch (requested)
+    {
+    case OutputBackend::Auto:
+        // Pipes are best served by vmsplice; regular files by io_uring.
+        if (can_splice)
+            return OutputBackend::Vmsplice;
+        return can_uring ? OutputBackend::IoUring : OutputBackend::Writev;
+    case OutputBackend::Vmsplice:
+        return can_splice ? OutputBackend::Vmsplice : OutputBackend::Writev;
+    case OutputBackend::IoUring:
+        return can_uring ? OutputBackend::IoUring : OutputBackend::Writev;
+    default:
+        return requested;
+    }
+#endif
+}
+
+std::uint64_t emit_repeated(int fd, std::string_view line, std::uint64_t count, OutputBackend backend)
+{
+    if (line.empty() || count == 0)
+        return 0;
+    if (backend == OutputBackend::Auto || backend == OutputBackend::Buffered)
+        throw std::invalid_argument("emit_repeated: backend must be resolved to a block backend");
+
+    RepeatedBlock block(line);
+    std::uint64_t remaining = count;
+
+#ifdef GREET_HAVE_IO_URING
+    if (backend == OutputBackend::IoUring)
+    {
+        if (uring_emit_blocks(fd, block.data(), block.lines(), block.line_size(), count))
+            return count * line.size();
+        backend = OutputBackend::Writev;
+    }
+#endif
+
+#ifndef _WIN32
+    if (backend == OutputBackend::Writev || backend == OutputBackend::Vmsplice || backend == OutputBackend::IoUring)
+    {
+        struct iovec iov[kMaxIov];
+        while (remaining > 0)
+        {
+            int n = 0;
+            for (; n < kMaxIov && remaining > 0; ++n)
+            {
+                std::size_t lines = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, block.lines()));
+                iov[n].iov_base = const_cast<char *>(block.data());
+                iov[n].iov_len = lines * block.line_size();
+                remaining -= lines;
+            }
+            write_iov(fd, iov, n, backend == OutputBackend::Vmsplice);
+        }
+        return count * line.size();
+    }
+#endif
+
+    while (remaining > 0)
+    {
+        std::size_t lines = static_cast<std::size_t>(std::min<std::uint64_t>(remaining, block.lines()));
+        write_all(fd, block.data(), lines * block.line_size());
+        remaining -= lines;
+    }
+    return count * line.size();
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// How greet_world pushes repeated greetings to its output.
+enum class OutputBackend
+{
+    Auto,     // pick the fastest backend available for the descriptor
+    Buffered, // OutputWriter, honouring the flush policy
+    Write,    // one write(2) per pre-rendered block
+    Writev,   // many pre-rendered blocks per writev(2)
+    Vmsplice, // map pre-rendered blocks into a pipe with vmsplice(2) (Linux)
+    IoUring,  // concurrent writes through io_uring to regular files (Linux, opt-in build)
+};
+
+// Parse a backend name. Throws std::invalid_argument for unknown names.
+OutputBackend parse_output_backend(std::string_view name);
+const char *to_string(OutputBackend backend);
+
+// Resolve Auto (and any backend the platform or descriptor cannot use) to
+// the backend emit_repeated() will actually run.
+OutputBackend resolve_output_backend(int fd, OutputBackend requested);
+
+// Write `line` to `fd` `count` times. The lines are rendered once into a
+// page-aligned block which is then written repeatedly, so nothing is copied per
+// line. `backend` must not be Buffered or Auto; resolve it first. Returns the
+// number of bytes written. Throws std::system_error on write failures.
+std::uint64_t emit_repeated(int fd, std::string_view line, std::uint64_t count, OutputBackend backend);
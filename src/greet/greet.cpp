@@ -1,6 +1,45 @@
 #include "greet.h"
+#include "greet_template.h"
+
+#include <cstring>
 
 std::string greet()
 {
-    return "Greet, World!";
+    return std::string(greet_view());
+}
+
+void greet(std::string &out)
+{
+    out.append(greet_view());
+}
+
+std::size_t greet(char *buffer, std::size_t capacity)
+{
+    constexpr std::string_view greeting = greet_view();
+    if (buffer != nullptr && greeting.size() <= capacity)
+        std::memcpy(buffer, greeting.data(), greeting.size());
+    return greeting.size();
+}
+
+void greet_batch(const std::string_view *names, std::size_t count, GreetBatch &out)
+{
+    static const GreetTemplate tmpl(kGreetPattern);
+    greet_batch(names, count, out, tmpl);
+}
+
+void greet_batch(const std::string_view *names, std::size_t count, GreetBatch &out,
+                 const GreetTemplate &tmpl)
+{
+    out.offsets.resize(count + 1);
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        out.offsets[i] = total;
+        total += tmpl.rendered_size(names[i]);
+    }
+    out.offsets[count] = total;
+
+    out.data.resize(total);
+    for (std::size_t i = 0; i < count; ++i)
+        tmpl.render(names[i], &out.data[out.offsets[i]], total - out.offsets[i]);
 }
@@ -1,6 +1,78 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <vector>
+
+class GreetTemplate;
+
+// Build "Greet, <name>!" at compile time as a fixed-size character array (no
+// terminating null), e.g. `constexpr auto g = greet_literal("World");`.
+template <std::size_t N>
+constexpr std::array<char, N + 7> greet_literal(const char (&name)[N])
+{
+    constexpr char prefix[] = "Greet, ";
+    std::array<char, N + 7> out{};
+    std::size_t i = 0;
+    for (std::size_t j = 0; j + 1 < sizeof(prefix); ++j)
+        out[i++] = prefix[j];
+    for (std::size_t j = 0; j + 1 < N; ++j)
+        out[i++] = name[j];
+    out[i] = '!';
+    return out;
+}
+
+// The greeting used by the program, resolved at compile time.
+inline constexpr auto kGreeting = greet_literal("World");
+
+// Pattern for personalised greetings; see GreetTemplate.
+inline constexpr std::string_view kGreetPattern = "Greet, {name}!";
 
 // Return the greeting message used by the program.
 std::string greet();
+
+// Return the greeting as a view into static storage. Never allocates.
+constexpr std::string_view greet_view()
+{
+    return std::string_view(kGreeting.data(), kGreeting.size());
+}
+
+// Append the greeting to `out`. Only allocates if `out` has to grow.
+void greet(std::string &out);
+
+// Copy the greeting into `buffer` if it fits in `capacity` bytes (no
+// terminating null is written). Returns the length of the greeting either way,
+// so callers can size the buffer with a first call.
+std::size_t greet(char *buffer, std::size_t capacity);
+
+// Greetings for a batch of names, stored back to back in one buffer. Greeting
+// `i` is `data[offsets[i], offsets[i + 1])`. Storage comes from `resource`, so
+// a batch can live in an arena such as std::pmr::monotonic_buffer_resource.
+struct GreetBatch
+{
+    explicit GreetBatch(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+        : data(resource), offsets(resource)
+    {
+    }
+
+    std::pmr::string data;
+    std::pmr::vector<std::size_t> offsets;
+
+    std::size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+    std::string_view operator[](std::size_t i) const
+    {
+        return std::string_view(data).substr(offsets[i], offsets[i + 1] - offsets[i]);
+    }
+};
+
+// Render a greeting for each of `count` names into `out`, replacing its
+// contents. The output is sized once up front, so reusing `out` across batches
+// of similar size does not allocate.
+void greet_batch(const std::string_view *names, std::size_t count, GreetBatch &out);
+
+// As above, rendering each name with `tmpl` instead of kGreetPattern.
+void greet_batch(const std::string_view *names, std::size_t count, GreetBatch &out,
+                 const GreetTemplate &tmpl);
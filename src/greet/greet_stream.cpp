@@ -0,0 +1,457 @@
+#include "greet_stream.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "line_reader.h"
+#include "metrics.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "mapped_file.h"
+#endif
+
+StreamStats greet_stream(int in_fd, int out_fd, const GreetTemplate &tmpl, FlushPolicy flush)
+{
+    // Rendering happens inline, so it is the time in this span outside the
+    // nested read and write spans.
+    GREET_TRACE_SCOPE("greet_stream");
+    StreamStats stats;
+    LineReader in(in_fd);
+    OutputWriter out(out_fd, flush);
+
+    std::string_view name;
+    while (in.next(name))
+    {
+        std::size_t size = tmpl.rendered_size(name) + 1;
+        char *dest = out.prepare(size);
+        tmpl.render(name, dest, size);
+        dest[size - 1] = '\n';
+        out.commit(size);
+        ++stats.lines;
+    }
+    out.flush();
+    stats.bytes = out.bytes_written();
+    metrics().counter("lines").add(stats.lines);
+    return stats;
+}
+
+namespace
+{
+constexpr std::size_t kChunkSize = 1024 * 1024;
+// Longest line the reader stage accepts, so a chunk's buffer has a fixed size.
+constexpr std::size_t kMaxLine = 1024 * 1024;
+constexpr std::size_t kBufferSize = kChunkSize + kMaxLine;
+
+// A newline-aligned run of input and the greetings rendered from it. `input`
+// views either `buffer` or a memory-mapped file. `buffer` holds kBufferSize
+// bytes once the reader stage has used the chunk.
+struct Chunk
+{
+    std::uint64_t seq = 0;
+    std::unique_ptr<char[]> buffer;
+    std::string_view input;
+    std::string output;
+    std::uint64_t lines = 0;
+};
+
+// Read up to `size` bytes. Returns false, without reading, if `wake_fd`
+// becomes readable first; -1 never does.
+bool read_some(int fd, char *data, std::size_t size, int wake_fd, std::size_t &got)
+{
+    GREET_TRACE_SCOPE("read");
+    for (;;)
+    {
+#ifndef _WIN32
+        if (wake_fd >= 0)
+        {
+            pollfd fds[2] = {{fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "poll");
+            }
+            if (fds[1].revents != 0)
+                return false;
+        }
+#else
+        (void)wake_fd;
+#endif
+#ifdef _WIN32
+        int n = _read(fd, data, static_cast<unsigned>(size));
+#else
+        ssize_t n = ::read(fd, data, size);
+#endif
+        if (n >= 0)
+        {
+            got = static_cast<std::size_t>(n);
+            return true;
+        }
+        if (errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), "read");
+    }
+}
+
+void render_chunk(Chunk &chunk, const GreetTemplate &tmpl)
+{
+    GREET_TRACE_SCOPE("render");
+    std::string &output = chunk.output;
+    std::size_t used = 0;
+    chunk.lines = 0;
+    std::string_view input = chunk.input;
+    while (!input.empty())
+    {
+        std::size_t nl = input.find('\n');
+        std::string_view name = input.substr(0, nl);
+        input.remove_prefix(nl == std::string_view::npos ? input.size() : nl + 1);
+        if (!name.empty() && name.back() == '\r')
+            name.remove_suffix(1);
+
+        std::size_t size = tmpl.rendered_size(name) + 1;
+        if (output.size() - used < size)
+            output.resize(std::max(2 * output.size(), used + size));
+        tmpl.render(name, &output[used], size);
+        output[used + size - 1] = '\n';
+        used += size;
+        ++chunk.lines;
+    }
+    output.resize(used);
+}
+
+// Shared state of the reader, worker and writer stages.
+class Pipeline
+{
+public:
+    explicit Pipeline(std::size_t chunks) : storage_(chunks)
+    {
+        for (Chunk &chunk : storage_)
+            free_.push_back(&chunk);
+#ifndef _WIN32
+        if (pipe(wake_) != 0)
+            throw std::system_error(errno, std::generic_category(), "pipe");
+        fcntl(wake_[0], F_SETFD, FD_CLOEXEC);
+        fcntl(wake_[1], F_SETFD, FD_CLOEXEC);
+#endif
+    }
+
+    ~Pipeline()
+    {
+#ifndef _WIN32
+        ::close(wake_[0]);
+        ::close(wake_[1]);
+#endif
+    }
+
+    Pipeline(const Pipeline &) = delete;
+    Pipeline &operator=(const Pipeline &) = delete;
+
+    // Becomes readable once the pipeline has failed, so a reader blocked on
+    // its input can stop; -1 where input cannot be polled.
+    int wake_fd() const { return wake_[0]; }
+
+    Chunk *acquire_free()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        free_cv_.wait(lock, [&] { return !free_.empty() || failed(); });
+        if (failed())
+            return nullptr;
+        Chunk *chunk = free_.back();
+        free_.pop_back();
+        return chunk;
+    }
+
+    void release(Chunk *chunk)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_.push_back(chunk);
+        free_cv_.notify_one();
+    }
+
+    void push_work(Chunk *chunk)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        work_.push_back(chunk);
+        work_cv_.notify_one();
+    }
+
+    // Returns nullptr once the input is exhausted or the pipeline failed.
+    Chunk *pop_work()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        work_cv_.wait(lock, [&] { return !work_.empty() || input_done_ || failed(); });
+        if (work_.empty() || failed())
+            return nullptr;
+        Chunk *chunk = work_.front();
+        work_.pop_front();
+        return chunk;
+    }
+
+    void push_done(Chunk *chunk)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_.emplace(chunk->seq, chunk);
+        done_cv_.notify_one();
+    }
+
+    // Wait for chunk `seq`. Returns nullptr when there are no more chunks.
+    // Rethrows the first error raised by another stage.
+    Chunk *pop_done(std::uint64_t seq)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_cv_.wait(lock, [&] { return done_.count(seq) || (input_done_ && seq == total_) || failed(); });
+        if (failed())
+            std::rethrow_exception(error_);
+        auto it = done_.find(seq);
+        if (it == done_.end())
+            return nullptr;
+        Chunk *chunk = it->second;
+        done_.erase(it);
+        return chunk;
+    }
+
+    void finish_input(std::uint64_t total)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        input_done_ = true;
+        total_ = total;
+        work_cv_.notify_all();
+        done_cv_.notify_all();
+    }
+
+    void fail(std::exception_ptr error)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!error_)
+        {
+            error_ = error;
+#ifndef _WIN32
+            char byte = 0;
+            while (::write(wake_[1], &byte, 1) < 0 && errno == EINTR)
+            {
+            }
+#endif
+        }
+        free_cv_.notify_all();
+        work_cv_.notify_all();
+        done_cv_.notify_all();
+    }
+
+private:
+    bool failed() const { return error_ != nullptr; }
+
+    std::vector<Chunk> storage_;
+    std::mutex mutex_;
+    std::condition_variable free_cv_, work_cv_, done_cv_;
+    std::vector<Chunk *> free_;
+    std::deque<Chunk *> work_;
+    std::map<std::uint64_t, Chunk *> done_;
+    bool input_done_ = false;
+    std::uint64_t total_ = 0;
+    std::exception_ptr error_;
+    int wake_[2] = {-1, -1}; // self-pipe written by fail()
+};
+
+void read_chunks(int in_fd, Pipeline &pipeline)
+{
+    std::string carry;
+    std::uint64_t seq = 0;
+    bool eof = false;
+    while (!eof)
+    {
+        Chunk *chunk = pipeline.acquire_free();
+        if (chunk == nullptr)
+            return;
+        // Allocated once per chunk and never cleared: read() fills it.
+        if (!chunk->buffer)
+            chunk->buffer.reset(new char[kBufferSize]);
+        char *data = chunk->buffer.get();
+        std::memcpy(data, carry.data(), carry.size());
+        std::size_t size = carry.size();
+
+        // Read at least a chunk's worth, and until there is a newline to split
+        // at. The carried-over partial line has none.
+        bool newline = false;
+        while (!eof && (size < kChunkSize || !newline))
+        {
+            if (!newline && size > kMaxLine)
+                throw std::runtime_error("input line longer than " + std::to_string(kMaxLine) + " bytes");
+            std::size_t n = 0;
+            if (!read_some(in_fd, data + size, kBufferSize - size, pipeline.wake_fd(), n))
+                return; // another stage failed
+            newline = newline || std::memchr(data + size, '\n', n) != nullptr;
+            size += n;
+            eof = n == 0;
+        }
+        std::size_t split = size;
+        if (!eof)
+        {
+            while (data[split - 1] != '\n')
+                --split;
+        }
+        carry.assign(data + split, size - split);
+        if (split == 0)
+        {
+            pipeline.release(chunk);
+            break;
+        }
+        chunk->input = std::string_view(data, split);
+        chunk->seq = seq++;
+        pipeline.push_work(chunk);
+    }
+    pipeline.finish_input(seq);
+}
+
+// Hand out newline-aligned slices of `data` without copying them.
+void slice_chunks(std::string_view data, std::size_t slice, Pipeline &pipeline)
+{
+    std::uint64_t seq = 0;
+    while (!data.empty())
+    {
+        Chunk *chunk = pipeline.acquire_free();
+        if (chunk == nullptr)
+            return;
+        std::size_t nl = slice < data.size() ? data.find('\n', slice - 1) : std::string_view::npos;
+        std::size_t size = nl == std::string_view::npos ? data.size() : nl + 1;
+        chunk->input = data.substr(0, size);
+        data.remove_prefix(size);
+        chunk->seq = seq++;
+        pipeline.push_work(chunk);
+    }
+    pipeline.finish_input(seq);
+}
+
+// Run `produce` as the reader stage of a pipeline with `workers` render
+// threads, writing the results to `out_fd` in order.
+template <typename Producer>
+StreamStats run_pipeline(Producer produce, int out_fd, const GreetTemplate &tmpl, unsigned workers)
+{
+    if (workers == 0)
+        workers = 1;
+    // Two chunks per worker keeps every worker busy while the writer drains.
+    Pipeline pipeline(2 * workers + 2);
+
+    auto guarded = [&pipeline](auto body) {
+        return [&pipeline, body]() {
+            try
+            {
+                body();
+            }
+            catch (...)
+            {
+                pipeline.fail(std::current_exception());
+            }
+        };
+    };
+
+    Histogram *render_ns = metrics_timing_enabled() ? &metrics().histogram("render_chunk_ns") : nullptr;
+    Counter &lines = metrics().counter("lines");
+    Counter &bytes = metrics().counter("bytes_written");
+
+    std::vector<std::thread> threads;
+    threads.emplace_back(guarded([&] { produce(pipeline); }));
+    for (unsigned i = 0; i < workers; ++i)
+    {
+        threads.emplace_back(guarded([&] {
+            while (Chunk *chunk = pipeline.pop_work())
+            {
+                if (render_ns == nullptr)
+                {
+                    render_chunk(*chunk, tmpl);
+                }
+                else
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    render_chunk(*chunk, tmpl);
+                    render_ns->record(static_cast<std::uint64_t>(
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+                            .count()));
+                }
+                pipeline.push_done(chunk);
+            }
+        }));
+    }
+
+    StreamStats stats;
+    try
+    {
+        for (std::uint64_t seq = 0;; ++seq)
+        {
+            Chunk *chunk = pipeline.pop_done(seq);
+            if (chunk == nullptr)
+                break;
+            write_all(out_fd, chunk->output.data(), chunk->output.size());
+            stats.lines += chunk->lines;
+            stats.bytes += chunk->output.size();
+            lines.add(chunk->lines);
+            bytes.add(chunk->output.size());
+            pipeline.release(chunk);
+        }
+    }
+    catch (...)
+    {
+        pipeline.fail(std::current_exception());
+        for (std::thread &thread : threads)
+            thread.join();
+        throw;
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+    return stats;
+}
+} // namespace
+
+StreamStats greet_stream_parallel(int in_fd, int out_fd, const GreetTemplate &tmpl, unsigned workers)
+{
+    return run_pipeline([in_fd](Pipeline &pipeline) { read_chunks(in_fd, pipeline); }, out_fd, tmpl, workers);
+}
+
+StreamStats greet_file_parallel(const std::string &path, int out_fd, const GreetTemplate &tmpl, unsigned workers)
+{
+#ifdef _WIN32
+    int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), path);
+    try
+    {
+        StreamStats stats = greet_stream_parallel(fd, out_fd, tmpl, workers);
+        _close(fd);
+        return stats;
+    }
+    catch (...)
+    {
+        _close(fd);
+        throw;
+    }
+#else
+    MappedFile file(path);
+    std::string_view data = file.data();
+    // Several slices per worker balances uneven lines; the cap bounds the
+    // memory held by rendered-but-unwritten output.
+    std::size_t slice = data.size() / (8 * (workers == 0 ? 1 : workers));
+    slice = std::min(std::max(slice, kChunkSize), 16 * kChunkSize);
+    return run_pipeline([data, slice](Pipeline &pipeline) { slice_chunks(data, slice, pipeline); }, out_fd, tmpl,
+                        workers);
+#endif
+}
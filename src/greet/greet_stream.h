@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "greet_template.h"
+#include "output.h"
+
+struct StreamStats
+{
+    std::uint64_t lines = 0;
+    std::uint64_t bytes = 0;
+};
+
+// Read names from `in_fd`, one per line, and write one greeting per name to
+// `out_fd`, rendered with `tmpl` directly into the output buffer. Runs in
+// constant memory regardless of input size. Throws std::system_error on I/O
+// failures.
+StreamStats greet_stream(int in_fd, int out_fd, const GreetTemplate &tmpl, FlushPolicy flush);
+
+// As greet_stream(), but split into stages: a reader thread cuts the input
+// into newline-aligned chunks, `workers` threads render them, and the calling
+// thread writes the results back in input order. Memory use is bounded by a
+// fixed pool of chunks, so lines longer than 1 MiB are rejected with
+// std::runtime_error. Output is written a chunk at a time, so there is no
+// flush policy.
+StreamStats greet_stream_parallel(int in_fd, int out_fd, const GreetTemplate &tmpl, unsigned workers);
+
+// As greet_stream_parallel(), reading the names from the file at `path`. On
+// POSIX systems the file is memory-mapped and workers render newline-aligned
+// slices of the mapping in place, so names are never copied.
+StreamStats greet_file_parallel(const std::string &path, int out_fd, const GreetTemplate &tmpl, unsigned workers);
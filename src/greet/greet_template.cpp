@@ -0,0 +1,97 @@
+#include "greet_template.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+constexpr std::string_view kPlaceholder = "{name}";
+}
+
+GreetTemplate::GreetTemplate(std::string_view pattern)
+{
+    std::size_t run_start = 0;
+    auto close_run = [&]() {
+        std::size_t length = literals_.size() - run_start;
+        if (length != 0)
+            ops_.push_back({static_cast<std::uint32_t>(run_start), static_cast<std::uint32_t>(length)});
+        run_start = literals_.size();
+    };
+
+    for (std::size_t i = 0; i < pattern.size(); ++i)
+    {
+        char c = pattern[i];
+        if (c == '{' && pattern.substr(i, 2) == "{{")
+        {
+            literals_ += '{';
+            ++i;
+        }
+        else if (c == '}' && pattern.substr(i, 2) == "}}")
+        {
+            literals_ += '}';
+            ++i;
+        }
+        else if (c == '{' && pattern.substr(i, kPlaceholder.size()) == kPlaceholder)
+        {
+            close_run();
+            ops_.push_back({0, kName});
+            ++placeholders_;
+            i += kPlaceholder.size() - 1;
+        }
+        else if (c == '{' || c == '}')
+        {
+            throw std::invalid_argument("GreetTemplate: unexpected '" + std::string(1, c) + "' at offset " +
+                                        std::to_string(i) + " in \"" + std::string(pattern) + "\"");
+        }
+        else
+        {
+            literals_ += c;
+        }
+    }
+    close_run();
+    literal_size_ = literals_.size();
+}
+
+char *GreetTemplate::render_unchecked(std::string_view name, char *out) const
+{
+    for (const Op &op : ops_)
+    {
+        if (op.length == kName)
+        {
+            if (!name.empty())
+                std::memcpy(out, name.data(), name.size());
+            out += name.size();
+        }
+        else
+        {
+            std::memcpy(out, literals_.data() + op.offset, op.length);
+            out += op.length;
+        }
+    }
+    return out;
+}
+
+void GreetTemplate::render(std::string_view name, std::string &out) const
+{
+    std::size_t start = out.size();
+    out.resize(start + rendered_size(name));
+    render_unchecked(name, &out[start]);
+}
+
+std::size_t GreetTemplate::render(std::string_view name, char *buffer, std::size_t capacity) const
+{
+    std::size_t size = rendered_size(name);
+    if (buffer != nullptr && size <= capacity)
+        render_unchecked(name, buffer);
+    return size;
+}
+
+std::string_view GreetTemplate::render(std::string_view name, std::pmr::memory_resource &arena) const
+{
+    std::size_t size = rendered_size(name);
+    if (size == 0)
+        return std::string_view();
+    char *out = static_cast<char *>(arena.allocate(size, alignof(char)));
+    render_unchecked(name, out);
+    return std::string_view(out, size);
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// A personalised greeting such as "Greet, {name}!". The pattern is parsed once
+// into a short list of literal/placeholder instructions which can then be
+// rendered any number of times without re-parsing.
+//
+// `{name}` is the only placeholder; `{{` and `}}` produce literal braces.
+class GreetTemplate
+{
+public:
+    // Throws std::invalid_argument if the pattern is malformed.
+    explicit GreetTemplate(std::string_view pattern);
+
+    // Number of bytes render() produces for `name`.
+    std::size_t rendered_size(std::string_view name) const
+    {
+        return literal_size_ + placeholders_ * name.size();
+    }
+
+    // Append the greeting for `name` to `out`. Grows `out` at most once.
+    void render(std::string_view name, std::string &out) const;
+
+    // Write the greeting for `name` into `buffer` if it fits in `capacity`
+    // bytes (no terminating null). Returns rendered_size(name) either way.
+    std::size_t render(std::string_view name, char *buffer, std::size_t capacity) const;
+
+    // Render the greeting for `name` into memory taken from `arena` and return a
+    // view of it. The view stays valid until the arena is released, which makes
+    // bulk reset between batches a single std::pmr::monotonic_buffer_resource::
+    // release() call.
+    std::string_view render(std::string_view name, std::pmr::memory_resource &arena) const;
+
+private:
+    // A run of `literals_` starting at `offset`, or the name when
+    // `length == kName`.
+    struct Op
+    {
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+    static constexpr std::uint32_t kName = UINT32_MAX;
+
+    char *render_unchecked(std::string_view name, char *out) const;
+
+    std::string literals_;
+    std::vector<Op> ops_;
+    std::size_t literal_size_ = 0;
+    std::size_t placeholders_ = 0;
+};
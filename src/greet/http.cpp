@@ -0,0 +1,281 @@
+#include "http.h"
+
+#include <charconv>
+
+#include "greet.h"
+#include "metrics.h"
+
+namespace
+{
+bool iequals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+    for (std::size_t i = 0; i < a.size(); ++i)
+    {
+        char x = a[i], y = b[i];
+        if (x >= 'A' && x <= 'Z')
+            x = static_cast<char>(x - 'A' + 'a');
+        if (y >= 'A' && y <= 'Z')
+            y = static_cast<char>(y - 'A' + 'a');
+        if (x != y)
+            return false;
+    }
+    return true;
+}
+
+// Whether the comma-separated header `value` lists `token`.
+bool has_token(std::string_view value, std::string_view token)
+{
+    while (!value.empty())
+    {
+        std::size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+            item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t'))
+            item.remove_suffix(1);
+        if (iequals(item, token))
+            return true;
+        value.remove_prefix(comma == std::string_view::npos ? value.size() : comma + 1);
+    }
+    return false;
+}
+
+int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+// Decode a URL query value ('+' and %XX escapes) into `out`.
+bool url_decode(std::string_view in, std::string &out)
+{
+    out.clear();
+    for (std::size_t i = 0; i < in.size(); ++i)
+    {
+        char c = in[i];
+        if (c == '+')
+        {
+            out += ' ';
+        }
+        else if (c == '%')
+        {
+            if (i + 2 >= in.size())
+                return false;
+            int hi = hex_value(in[i + 1]), lo = hex_value(in[i + 2]);
+            if (hi < 0 || lo < 0)
+                return false;
+            out += static_cast<char>(hi * 16 + lo);
+            i += 2;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    return true;
+}
+
+// The value of query parameter `key` in `query`; empty if absent.
+std::string_view query_param(std::string_view query, std::string_view key)
+{
+    while (!query.empty())
+    {
+        std::size_t amp = query.find('&');
+        std::string_view pair = query.substr(0, amp);
+        std::size_t eq = pair.find('=');
+        if (pair.substr(0, eq) == key)
+            return eq == std::string_view::npos ? std::string_view() : pair.substr(eq + 1);
+        query.remove_prefix(amp == std::string_view::npos ? query.size() : amp + 1);
+    }
+    return std::string_view();
+}
+
+// Length of the request head at the front of `in`, up to and including the
+// empty line that ends it, or npos if that line has not arrived. Lines end in
+// CRLF, or in a bare LF, which RFC 9112 allows a recipient to accept.
+std::size_t head_length(std::string_view in)
+{
+    std::size_t start = 0;
+    for (;;)
+    {
+        std::size_t nl = in.find('\n', start);
+        if (nl == std::string_view::npos)
+            return std::string_view::npos;
+        if (nl == start || (nl == start + 1 && in[start] == '\r'))
+            return nl + 1;
+        start = nl + 1;
+    }
+}
+
+// Remove and return the first line of `text`, without its CRLF or LF.
+std::string_view next_line(std::string_view &text)
+{
+    std::size_t nl = text.find('\n');
+    std::string_view line = text.substr(0, nl);
+    text.remove_prefix(nl == std::string_view::npos ? text.size() : nl + 1);
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    return line;
+}
+} // namespace
+
+HttpGreeter::HttpGreeter(const GreetTemplate &tmpl) : tmpl_(tmpl), greeting_body_(greet_view())
+{
+    greeting_body_ += '\n';
+    respond(greeting_response_, "200 OK", greeting_body_, ConnectionHeader::None);
+}
+
+void HttpGreeter::respond(std::string &out, std::string_view status, std::string_view body,
+                          ConnectionHeader connection)
+{
+    char length[24];
+    auto end = std::to_chars(length, length + sizeof(length), body.size()).ptr;
+    out.append("HTTP/1.1 ").append(status);
+    out.append("\r\nContent-Type: text/plain\r\nContent-Length: ").append(length, end);
+    if (connection == ConnectionHeader::Close)
+        out.append("\r\nConnection: close");
+    else if (connection == ConnectionHeader::KeepAlive)
+        out.append("\r\nConnection: keep-alive");
+    out.append("\r\n\r\n").append(body);
+}
+
+std::size_t HttpGreeter::handle(std::string_view in, std::string &out, bool &close)
+{
+    std::size_t consumed = 0;
+    while (!close)
+    {
+        std::string_view rest = in.substr(consumed);
+        std::size_t length = head_length(rest);
+        if (length == std::string_view::npos)
+        {
+            if (rest.size() > kMaxHead)
+            {
+                respond(out, "431 Request Header Fields Too Large", "request head too large\n",
+                        ConnectionHeader::Close);
+                ++requests_;
+                close = true;
+            }
+            break;
+        }
+        if (length > kMaxHead)
+        {
+            respond(out, "431 Request Header Fields Too Large", "request head too large\n",
+                    ConnectionHeader::Close);
+            ++requests_;
+            close = true;
+            break;
+        }
+        close = !handle_one(rest.substr(0, length), out);
+        consumed += length;
+    }
+    return consumed;
+}
+
+// Answer the request whose head (request line, headers and the empty line,
+// see head_length()) is `head`. Returns false if the connection must close
+// afterwards.
+bool HttpGreeter::handle_one(std::string_view head, std::string &out)
+{
+    ++requests_;
+    std::string_view request_line = next_line(head);
+
+    std::size_t sp1 = request_line.find(' ');
+    std::size_t sp2 = request_line.rfind(' ');
+    if (sp1 == std::string_view::npos || sp2 == sp1)
+    {
+        respond(out, "400 Bad Request", "malformed request line\n", ConnectionHeader::Close);
+        return false;
+    }
+    std::string_view method = request_line.substr(0, sp1);
+    std::string_view target = request_line.substr(sp1 + 1, sp2 - sp1 - 1);
+    std::string_view version = request_line.substr(sp2 + 1);
+
+    bool keep_alive;
+    if (version == "HTTP/1.1")
+        keep_alive = true;
+    else if (version == "HTTP/1.0")
+        keep_alive = false;
+    else
+    {
+        respond(out, "400 Bad Request", "unsupported HTTP version\n", ConnectionHeader::Close);
+        return false;
+    }
+
+    for (std::string_view line = next_line(head); !line.empty(); line = next_line(head))
+    {
+        std::size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+        {
+            respond(out, "400 Bad Request", "malformed header\n", ConnectionHeader::Close);
+            return false;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 1);
+        if (iequals(name, "connection"))
+        {
+            if (has_token(value, "close"))
+                keep_alive = false;
+            else if (has_token(value, "keep-alive"))
+                keep_alive = true;
+        }
+        else if (iequals(name, "transfer-encoding") ||
+                 (iequals(name, "content-length") && value.find_first_not_of(" \t0") != std::string_view::npos))
+        {
+            // No endpoint takes a body; refuse rather than guess where it ends.
+            respond(out, "400 Bad Request", "request bodies are not supported\n", ConnectionHeader::Close);
+            return false;
+        }
+    }
+
+    // HTTP/1.0 closes by default, so a 1.0 connection kept open must say so.
+    ConnectionHeader connection = !keep_alive            ? ConnectionHeader::Close
+                                  : version == "HTTP/1.0" ? ConnectionHeader::KeepAlive
+                                                          : ConnectionHeader::None;
+
+    if (method != "GET")
+    {
+        respond(out, "405 Method Not Allowed", "only GET is supported\n", connection);
+        return keep_alive;
+    }
+
+    std::size_t question = target.find('?');
+    std::string_view path = target.substr(0, question);
+    std::string_view query = question == std::string_view::npos ? std::string_view() : target.substr(question + 1);
+    if (path == "/stats")
+    {
+        respond(out, "200 OK", metrics().render_text(), connection);
+        return keep_alive;
+    }
+    if (path != "/greet")
+    {
+        respond(out, "404 Not Found", "not found\n", connection);
+        return keep_alive;
+    }
+
+    std::string_view name = query_param(query, "name");
+    if (name.empty())
+    {
+        if (connection == ConnectionHeader::None)
+            out.append(greeting_response_);
+        else
+            respond(out, "200 OK", greeting_body_, connection);
+        return keep_alive;
+    }
+    if (!url_decode(name, name_))
+    {
+        respond(out, "400 Bad Request", "malformed query\n", connection);
+        return keep_alive;
+    }
+    body_.clear();
+    tmpl_.render(name_, body_);
+    body_ += '\n';
+    respond(out, "200 OK", body_, connection);
+    return keep_alive;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "greet_template.h"
+
+// Answers HTTP/1.1 `GET /greet[?name=...]` requests for the --http server
+// mode, and `GET /stats` with the text of the metrics registry (metrics.h).
+// Parsing works on views of the connection's input, and the response to the
+// unparameterised greeting is rendered once up front. Not thread-safe: use one
+// instance per event loop.
+class HttpGreeter
+{
+public:
+    // Longest request head accepted before answering 431 and closing.
+    static constexpr std::size_t kMaxHead = 8 * 1024;
+
+    explicit HttpGreeter(const GreetTemplate &tmpl);
+
+    // Answer every complete request at the front of `in`, appending the
+    // responses to `out`, and return the number of bytes consumed. Request
+    // lines may end in CRLF or a bare LF. Sets `close`
+    // when the connection must be closed once `out` is sent (the client asked
+    // for it, HTTP/1.0 without keep-alive, or a bad request); no further input
+    // is consumed after that.
+    std::size_t handle(std::string_view in, std::string &out, bool &close);
+
+    // Complete requests answered so far, including error responses.
+    std::uint64_t requests() const { return requests_; }
+
+private:
+    // The Connection header a response carries.
+    enum class ConnectionHeader
+    {
+        None,
+        Close,
+        KeepAlive,
+    };
+
+    void respond(std::string &out, std::string_view status, std::string_view body, ConnectionHeader connection);
+    bool handle_one(std::string_view head, std::string &out);
+
+    const GreetTemplate &tmpl_;
+    std::string greeting_body_;
+    std::string greeting_response_; // full bytes of the keep-alive default response
+    std::string name_;              // scratch for the decoded name
+    std::string body_;              // scratch for the rendered greeting
+    std::uint64_t requests_ = 0;
+};
@@ -0,0 +1,85 @@
+#include "line_reader.h"
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "trace.h"
+
+LineReader::LineReader(int fd, std::size_t capacity) : fd_(fd), buffer_(capacity == 0 ? 1 : capacity)
+{
+}
+
+bool LineReader::next(std::string_view &line)
+{
+    // Bytes after begin_ already searched for a newline.
+    std::size_t scanned = 0;
+    for (;;)
+    {
+        const char *start = buffer_.data() + begin_;
+        const void *nl = std::memchr(start + scanned, '\n', end_ - begin_ - scanned);
+        if (nl != nullptr)
+        {
+            std::size_t length = static_cast<const char *>(nl) - start;
+            begin_ += length + 1;
+            if (length > 0 && start[length - 1] == '\r')
+                --length;
+            line = std::string_view(start, length);
+            return true;
+        }
+        scanned = end_ - begin_;
+        if (eof_ || !refill())
+        {
+            if (begin_ == end_)
+                return false;
+            std::size_t length = end_ - begin_;
+            if (buffer_[end_ - 1] == '\r')
+                --length;
+            line = std::string_view(buffer_.data() + begin_, length);
+            begin_ = end_;
+            return true;
+        }
+    }
+}
+
+bool LineReader::refill()
+{
+    GREET_TRACE_SCOPE("read");
+    std::size_t pending = end_ - begin_;
+    if (begin_ > 0)
+    {
+        std::memmove(buffer_.data(), buffer_.data() + begin_, pending);
+        begin_ = 0;
+        end_ = pending;
+    }
+    if (end_ == buffer_.size())
+        buffer_.resize(buffer_.size() * 2);
+
+    for (;;)
+    {
+#ifdef _WIN32
+        int n = _read(fd_, buffer_.data() + end_, static_cast<unsigned>(buffer_.size() - end_));
+#else
+        ssize_t n = ::read(fd_, buffer_.data() + end_, buffer_.size() - end_);
+#endif
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+        if (n == 0)
+        {
+            eof_ = true;
+            return false;
+        }
+        end_ += static_cast<std::size_t>(n);
+        return true;
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// Reads newline-delimited records from a file descriptor through one large
+// buffer, bypassing iostreams. Memory use is bounded by the buffer size or the
+// longest line, whichever is larger. Throws std::system_error on read errors.
+class LineReader
+{
+public:
+    static constexpr std::size_t kDefaultCapacity = 1024 * 1024;
+
+    explicit LineReader(int fd, std::size_t capacity = kDefaultCapacity);
+
+    // Fetch the next line without its "\n" or "\r\n" terminator. A final line
+    // without a terminator is still returned. The view stays valid until the
+    // next call. Returns false at end of input.
+    bool next(std::string_view &line);
+
+private:
+    // Read more input, keeping the unconsumed tail. Returns false at EOF.
+    bool refill();
+
+    int fd_;
+    std::vector<char> buffer_;
+    std::size_t begin_ = 0;
+    std::size_t end_ = 0;
+    bool eof_ = false;
+};
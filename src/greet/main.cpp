@@ -1,8 +1,461 @@
-#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include "block_output.h"
 #include "greet.h"
+#include "greet_stream.h"
+#include "greet_template.h"
+#include "metrics.h"
+#include "output.h"
+#include "trace.h"
+#ifdef __linux__
+#include "server.h"
+#endif
 
-int main()
+namespace
 {
-    std::cout << greet() << std::endl;
+constexpr int kStdin = 0;
+constexpr int kStdout = 1;
+constexpr int kStderr = 2;
+
+struct Options
+{
+    std::uint64_t count = 1;
+    std::uint64_t bytes = 0; // when non-zero, overrides count
+    FlushPolicy flush = FlushPolicy::Line;
+    bool flush_given = false;
+    OutputBackend backend = OutputBackend::Auto;
+    bool bulk = false;
+    bool from_stdin = false;
+    std::string input_path;
+    unsigned threads = 1;
+    bool threads_given = false;
+    std::string pattern{kGreetPattern};
+    bool pattern_given = false;
+    std::string serve_path;
+    int http_port = 0;
+    unsigned reactors = 1;
+    bool pin_cpus = false;
+    std::string shm_name;
+    unsigned spins = 1000;
+    int udp_port = 0;
+    unsigned batch = 64;
+    std::string trace_path;
+    bool stats = false;
+};
+
+void print_usage(int fd)
+{
+    std::string usage =
+        "usage: greet_world [--count N | --bytes N | --stdin | --input FILE] [--flush line|block|none]\n"
+        "                   [--backend B] [--template PATTERN] [--threads N]\n"
+        "       greet_world [--serve SOCKET] [--http PORT] [--reactors N [--pin]] [--template PATTERN]\n"
+        "       greet_world --shm NAME [--spin N] [--template PATTERN]\n"
+        "       greet_world --udp PORT [--batch N] [--template PATTERN]\n"
+        "  --count N    print the greeting N times\n"
+        "  --bytes N    print whole greetings until at least N bytes are written\n"
+        "  --flush P    when to hand output to the OS (default: line, or block in bulk mode)\n"
+        "  --backend B  bulk output backend: auto, buffered, write, writev, vmsplice or io_uring\n"
+        "               (default: auto; vmsplice and io_uring fall back to writev when unusable)\n"
+        "  --stdin      read names from stdin, one per line, and greet each of them\n"
+        "  --input F    greet each line of file F, memory-mapped and rendered on --threads workers\n"
+        "               (default: one per core)\n"
+        "  --template P pattern for greeting names from --stdin, --input and the servers\n"
+        "               (default: \"";
+    usage += kGreetPattern;
+    usage += "\")\n"
+             "  --threads N  render greetings on N worker threads, keeping input order\n"
+             "  --serve S    answer greeting requests on Unix socket S until interrupted: one request\n"
+             "               per line, empty for the default greeting or a name (Linux only)\n"
+             "  --http P     serve GET /greet?name=... over HTTP/1.1 on 127.0.0.1:P (Linux only)\n"
+             "  --reactors N run N independent event loops, one per thread (default: 1)\n"
+             "  --pin        pin each event loop to its own CPU\n"
+             "  --shm NAME   serve one client over the shared-memory rings in segment NAME (Linux only)\n"
+             "  --spin N     polls before a --shm wait sleeps on a futex (default: 1000)\n"
+             "  --udp P      answer greeting datagrams on 127.0.0.1:P (Linux only)\n"
+             "  --batch N    datagrams received and answered per system call (default: 64)\n"
+             "  --trace F    write a Chrome trace of the read, render and write stages to F on exit\n"
+             "               (needs a build configured with -DGREET_TRACING=ON)\n"
+             "  --stats      time writes and requests, and print the counters and latency histograms\n"
+             "               on stderr on exit. Servers answer the request line /stats or GET /stats\n"
+             "               with the metrics either way; latencies need --stats\n"
+             "Bulk modes report throughput on stderr.\n";
+    write_all(fd, usage.data(), usage.size());
+}
+
+// Diagnostics are written straight to the descriptor. greet_world does not
+// use iostreams, so a plain run pays for neither their static initialisation
+// nor their buffering.
+void print_error(std::string_view message) noexcept
+{
+    try
+    {
+        std::string line = "greet_world: ";
+        line += message;
+        line += '\n';
+        write_all(kStderr, line.data(), line.size());
+    }
+    catch (const std::exception &)
+    {
+    }
+}
+
+std::uint64_t parse_size(std::string_view flag, const std::string &value)
+{
+    std::size_t used = 0;
+    unsigned long long n = 0;
+    try
+    {
+        n = std::stoull(value, &used);
+    }
+    catch (const std::exception &)
+    {
+        used = 0;
+    }
+    if (used != value.size() || value.empty() || value[0] == '-')
+        throw std::invalid_argument(std::string(flag) + ": expected a non-negative integer, got \"" + value + "\"");
+    return n;
+}
+
+int parse_port(std::string_view flag, const std::string &value)
+{
+    std::uint64_t port = parse_size(flag, value);
+    if (port == 0 || port > 65535)
+        throw std::invalid_argument(std::string(flag) + ": port must be between 1 and 65535");
+    return static_cast<int>(port);
+}
+
+Options parse_args(int argc, char **argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        std::string value;
+        auto eq = arg.find('=');
+        if (arg.rfind("--", 0) == 0 && eq != std::string::npos)
+        {
+            value = arg.substr(eq + 1);
+            arg.erase(eq);
+        }
+        else if (arg != "--help" && arg != "-h" && arg != "--stdin" && arg != "--pin" &&
+                 arg != "--stats")
+        {
+            if (i + 1 >= argc)
+                throw std::invalid_argument(arg + ": missing value");
+            value = argv[++i];
+        }
+
+        if (arg == "--help" || arg == "-h")
+        {
+            print_usage(kStdout);
+            std::exit(0);
+        }
+        else if (arg == "--count")
+        {
+            opts.count = parse_size(arg, value);
+            opts.bytes = 0;
+            opts.bulk = true;
+        }
+        else if (arg == "--bytes")
+        {
+            opts.bytes = parse_size(arg, value);
+            opts.bulk = true;
+        }
+        else if (arg == "--flush")
+        {
+            opts.flush = parse_flush_policy(value);
+            opts.flush_given = true;
+        }
+        else if (arg == "--backend")
+        {
+            opts.backend = parse_output_backend(value);
+        }
+        else if (arg == "--stdin")
+        {
+            opts.from_stdin = true;
+            opts.bulk = true;
+        }
+        else if (arg == "--input")
+        {
+            opts.input_path = value;
+            opts.bulk = true;
+        }
+        else if (arg == "--serve")
+        {
+            opts.serve_path = value;
+        }
+        else if (arg == "--http")
+        {
+            opts.http_port = parse_port(arg, value);
+        }
+        else if (arg == "--udp")
+        {
+            opts.udp_port = parse_port(arg, value);
+        }
+        else if (arg == "--batch")
+        {
+            opts.batch = static_cast<unsigned>(parse_size(arg, value));
+        }
+        else if (arg == "--trace")
+        {
+            if (!kTracingCompiledIn)
+                throw std::invalid_argument("--trace: this build has no tracing (configure with -DGREET_TRACING=ON)");
+            opts.trace_path = value;
+        }
+        else if (arg == "--reactors")
+        {
+            opts.reactors = static_cast<unsigned>(parse_size(arg, value));
+        }
+        else if (arg == "--pin")
+        {
+            opts.pin_cpus = true;
+        }
+        else if (arg == "--stats")
+        {
+            opts.stats = true;
+        }
+        else if (arg == "--shm")
+        {
+            opts.shm_name = value;
+        }
+        else if (arg == "--spin")
+        {
+            opts.spins = static_cast<unsigned>(parse_size(arg, value));
+        }
+        else if (arg == "--template")
+        {
+            opts.pattern = value;
+            opts.pattern_given = true;
+        }
+        else if (arg == "--threads")
+        {
+            opts.threads = static_cast<unsigned>(parse_size(arg, value));
+            opts.threads_given = true;
+        }
+        else
+        {
+            throw std::invalid_argument("unknown option \"" + arg + "\"");
+        }
+    }
+    if (opts.bulk && !opts.flush_given)
+        opts.flush = FlushPolicy::Block;
+
+    // Compile the pattern now so a bad one is a usage error in every mode.
+    GreetTemplate(opts.pattern);
+    bool greets_names = opts.from_stdin || !opts.input_path.empty() || !opts.serve_path.empty() ||
+                        opts.http_port != 0 || !opts.shm_name.empty() || opts.udp_port != 0;
+    if (opts.pattern_given && !greets_names)
+        throw std::invalid_argument("--template: only --stdin, --input and the server modes greet names");
+    return opts;
+}
+
+void report_throughput(const char *mode, std::uint64_t lines, std::uint64_t bytes,
+                       std::chrono::steady_clock::duration elapsed)
+{
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    double mbps = seconds > 0 ? bytes / seconds / 1e6 : 0.0;
+    double lps = seconds > 0 ? lines / seconds : 0.0;
+    char report[256];
+    int size = std::snprintf(report, sizeof(report),
+                             "greet_world: %s: %llu lines, %llu bytes in %g s (%g MB/s, %g lines/s)\n", mode,
+                             static_cast<unsigned long long>(lines), static_cast<unsigned long long>(bytes), seconds,
+                             mbps, lps);
+    if (size > 0)
+        write_all(kStderr, report, std::min<std::size_t>(static_cast<std::size_t>(size), sizeof(report) - 1));
+}
+
+// Print the greeting repeatedly through the buffered writer, honouring the
+// flush policy. Returns the number of bytes written.
+std::uint64_t emit_buffered(const std::string &line, std::uint64_t lines, FlushPolicy flush)
+{
+    OutputWriter out(kStdout, flush);
+    for (std::uint64_t i = 0; i < lines; ++i)
+        out.write(line);
+    out.flush();
+    return out.bytes_written();
+}
+
+// Writes the trace, if one was requested, however main() returns.
+struct TraceExport
+{
+    std::string path;
+
+    ~TraceExport()
+    {
+        if (path.empty())
+            return;
+        try
+        {
+            write_chrome_trace(path);
+        }
+        catch (const std::system_error &e)
+        {
+            print_error(e.what());
+        }
+    }
+};
+
+// Prints the metrics, if asked to, however main() returns.
+struct StatsReport
+{
+    bool enabled;
+
+    ~StatsReport()
+    {
+        if (!enabled)
+            return;
+        try
+        {
+            std::string text = metrics().render_text();
+            write_all(kStderr, text.data(), text.size());
+        }
+        catch (const std::exception &e)
+        {
+            print_error(e.what());
+        }
+    }
+};
+
+// Print the greeting once with a single write(2), without touching the
+// option parser or the output buffers.
+int print_greeting()
+{
+    char line[greet_view().size() + 1];
+    std::size_t size = greet(line, sizeof(line));
+    line[size++] = '\n';
+    try
+    {
+        write_all(kStdout, line, size);
+    }
+    catch (const std::system_error &e)
+    {
+        print_error(e.what());
+        return 1;
+    }
+    return 0;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    // Most launches are a plain `greet_world`; keep their startup minimal.
+    if (argc <= 1)
+        return print_greeting();
+
+    Options opts;
+    try
+    {
+        opts = parse_args(argc, argv);
+    }
+    catch (const std::invalid_argument &e)
+    {
+        print_error(e.what());
+        print_usage(kStderr);
+        return 2;
+    }
+
+    StatsReport stats_report{opts.stats};
+    enable_metrics_timing(opts.stats);
+    TraceExport trace{opts.trace_path};
+    if (!opts.trace_path.empty())
+        start_tracing();
+
+    try
+    {
+        if (opts.udp_port != 0)
+        {
+#ifdef __linux__
+            run_udp_service(opts.udp_port, GreetTemplate(opts.pattern), opts.batch);
+            return 0;
+#else
+            throw std::invalid_argument("--udp is only supported on Linux");
+#endif
+        }
+        if (!opts.shm_name.empty())
+        {
+#ifdef __linux__
+            run_shm_service(opts.shm_name, GreetTemplate(opts.pattern), opts.spins);
+            return 0;
+#else
+            throw std::invalid_argument("--shm is only supported on Linux");
+#endif
+        }
+        if (!opts.serve_path.empty() || opts.http_port != 0)
+        {
+#ifdef __linux__
+            ServerOptions server;
+            server.unix_path = opts.serve_path;
+            server.http_port = opts.http_port;
+            server.reactors = opts.reactors;
+            server.pin_cpus = opts.pin_cpus;
+            run_server(server, GreetTemplate(opts.pattern));
+            return 0;
+#else
+            throw std::invalid_argument("--serve and --http are only supported on Linux");
+#endif
+        }
+        if (!opts.input_path.empty())
+        {
+            unsigned threads = opts.threads_given ? opts.threads : std::thread::hardware_concurrency();
+            GreetTemplate tmpl(opts.pattern);
+            auto start = std::chrono::steady_clock::now();
+            StreamStats stats = greet_file_parallel(opts.input_path, kStdout, tmpl, threads);
+            report_throughput("input", stats.lines, stats.bytes, std::chrono::steady_clock::now() - start);
+            return 0;
+        }
+        if (opts.from_stdin)
+        {
+            GreetTemplate tmpl(opts.pattern);
+            auto start = std::chrono::steady_clock::now();
+            StreamStats stats = opts.threads > 1 ? greet_stream_parallel(kStdin, kStdout, tmpl, opts.threads)
+                                                 : greet_stream(kStdin, kStdout, tmpl, opts.flush);
+            report_throughput("stdin", stats.lines, stats.bytes, std::chrono::steady_clock::now() - start);
+            return 0;
+        }
+
+        std::string line(greet_view());
+        line += '\n';
+        std::uint64_t lines = opts.count;
+        if (opts.bytes != 0)
+            lines = (opts.bytes + line.size() - 1) / line.size();
+
+        // An explicit flush policy only means something to the buffered writer.
+        OutputBackend backend = opts.backend;
+        if (!opts.bulk || (backend == OutputBackend::Auto && opts.flush_given))
+            backend = OutputBackend::Buffered;
+        backend = resolve_output_backend(kStdout, backend);
+
+        auto start = std::chrono::steady_clock::now();
+        std::uint64_t bytes = backend == OutputBackend::Buffered ? emit_buffered(line, lines, opts.flush)
+                                                                 : emit_repeated(kStdout, line, lines, backend);
+        if (backend != OutputBackend::Buffered)
+            metrics().counter("bytes_written").add(bytes);
+        if (opts.bulk)
+            report_throughput(to_string(backend), lines, bytes, std::chrono::steady_clock::now() - start);
+    }
+    catch (const std::invalid_argument &e)
+    {
+        print_error(e.what());
+        return 2;
+    }
+    catch (const std::system_error &e)
+    {
+        print_error(e.what());
+        return 1;
+    }
+    catch (const std::exception &e)
+    {
+        // For example a shared-memory segment that fails its checks.
+        print_error(e.what());
+        return 1;
+    }
     return 0;
 }
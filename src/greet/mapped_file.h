@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// A whole file mapped read-only into memory (POSIX only). Throws
+// std::system_error if the file cannot be opened or mapped.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    std::string_view data() const { return std::string_view(static_cast<const char *>(data_), size_); }
+
+private:
+    void *data_ = nullptr;
+    std::size_t size_ = 0;
+};
@@ -0,0 +1,165 @@
+#include "metrics.h"
+
+#include <cstdio>
+
+std::uint64_t Histogram::percentile(double percent) const noexcept
+{
+    std::uint64_t total = count();
+    if (total == 0)
+        return 0;
+    std::uint64_t rank = static_cast<std::uint64_t>(percent / 100.0 * total + 0.5);
+    if (rank == 0)
+        rank = 1;
+    if (rank >= total)
+        return max();
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < kBuckets; ++i)
+    {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen < rank)
+            continue;
+        if (i < kSubBuckets)
+            return i;
+        std::size_t shift = i / kSubBuckets - 1;
+        std::uint64_t low = (std::uint64_t(kSubBuckets) | (i % kSubBuckets)) << shift;
+        std::uint64_t mid = low + ((std::uint64_t(1) << shift) >> 1);
+        return mid < max() ? mid : max();
+    }
+    return max();
+}
+
+void Histogram::merge(const Histogram &other) noexcept
+{
+    for (std::size_t i = 0; i < kBuckets; ++i)
+    {
+        std::uint64_t n = other.buckets_[i].load(std::memory_order_relaxed);
+        if (n != 0)
+            buckets_[i].fetch_add(n, std::memory_order_relaxed);
+    }
+    count_.fetch_add(other.count(), std::memory_order_relaxed);
+    sum_.fetch_add(other.sum(), std::memory_order_relaxed);
+    std::uint64_t max = max_.load(std::memory_order_relaxed);
+    while (other.max() > max && !max_.compare_exchange_weak(max, other.max(), std::memory_order_relaxed))
+    {
+    }
+}
+
+namespace
+{
+std::atomic<bool> g_timing{false};
+
+// The shared instance of `name`, created on first use.
+template <typename Metric, typename Map>
+Metric &shared(Map &map, const std::string &name)
+{
+    auto &instances = map[name];
+    if (instances.empty())
+        instances.push_back(std::make_unique<Metric>());
+    return *instances.front();
+}
+
+template <typename Metric, typename Map>
+Metric &new_shard(Map &map, const std::string &name)
+{
+    auto &instances = map[name];
+    if (instances.empty())
+        instances.push_back(std::make_unique<Metric>()); // keep the first one shared
+    instances.push_back(std::make_unique<Metric>());
+    return *instances.back();
+}
+} // namespace
+
+Counter &MetricsRegistry::counter(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return shared<Counter>(counters_, name);
+}
+
+Gauge &MetricsRegistry::gauge(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return shared<Gauge>(gauges_, name);
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return shared<Histogram>(histograms_, name);
+}
+
+Counter &MetricsRegistry::counter_shard(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return new_shard<Counter>(counters_, name);
+}
+
+Gauge &MetricsRegistry::gauge_shard(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return new_shard<Gauge>(gauges_, name);
+}
+
+Histogram &MetricsRegistry::histogram_shard(const std::string &name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return new_shard<Histogram>(histograms_, name);
+}
+
+std::string MetricsRegistry::render_text() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::string out;
+    char line[512];
+    for (const auto &entry : counters_)
+    {
+        unsigned long long total = 0;
+        for (const auto &shard : entry.second)
+            total += shard->value();
+        std::snprintf(line, sizeof(line), "counter %s %llu\n", entry.first.c_str(), total);
+        out += line;
+    }
+    for (const auto &entry : gauges_)
+    {
+        long long total = 0;
+        for (const auto &shard : entry.second)
+            total += shard->value();
+        std::snprintf(line, sizeof(line), "gauge %s %lld\n", entry.first.c_str(), total);
+        out += line;
+    }
+    std::unique_ptr<Histogram> merged;
+    for (const auto &entry : histograms_)
+    {
+        const Histogram *h = entry.second.front().get();
+        if (entry.second.size() > 1)
+        {
+            merged = std::make_unique<Histogram>();
+            for (const auto &shard : entry.second)
+                merged->merge(*shard);
+            h = merged.get();
+        }
+        auto value = [](std::uint64_t v) { return static_cast<unsigned long long>(v); };
+        std::snprintf(line, sizeof(line),
+                      "histogram %s count=%llu mean=%llu p50=%llu p90=%llu p99=%llu p99.9=%llu max=%llu\n",
+                      entry.first.c_str(), value(h->count()), value(h->count() ? h->sum() / h->count() : 0),
+                      value(h->percentile(50)), value(h->percentile(90)), value(h->percentile(99)),
+                      value(h->percentile(99.9)), value(h->max()));
+        out += line;
+    }
+    return out;
+}
+
+MetricsRegistry &metrics()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+bool metrics_timing_enabled() noexcept
+{
+    return g_timing.load(std::memory_order_relaxed);
+}
+
+void enable_metrics_timing(bool enabled) noexcept
+{
+    g_timing.store(enabled, std::memory_order_relaxed);
+}
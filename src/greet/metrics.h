@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Process-wide counters, gauges and latency histograms. Metrics are created
+// by name through the registry, normally once at setup, and the returned
+// reference is kept for recording. Recording is lock-free and safe from any
+// number of threads: one relaxed atomic add for a counter or gauge; a
+// histogram sample is three relaxed adds plus a compare-and-swap loop that
+// only runs while the maximum grows.
+//
+// A metric written by several threads bounces its cache line between their
+// cores. Code that runs one loop per thread takes a shard instead: its own
+// instance of the metric, summed with the others under the same name when the
+// registry is read.
+//
+// Latency metrics need two clock reads per sample, so they are only recorded
+// when timing is enabled (see enable_metrics_timing()).
+
+class alignas(64) Counter
+{
+public:
+    void add(std::uint64_t n = 1) noexcept { value_.fetch_add(n, std::memory_order_relaxed); }
+    std::uint64_t value() const noexcept { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::uint64_t> value_{0};
+};
+
+class alignas(64) Gauge
+{
+public:
+    void set(std::int64_t v) noexcept { value_.store(v, std::memory_order_relaxed); }
+    void add(std::int64_t n) noexcept { value_.fetch_add(n, std::memory_order_relaxed); }
+    std::int64_t value() const noexcept { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::int64_t> value_{0};
+};
+
+// Log-linear histogram in the style of HdrHistogram: each power of two is
+// split into kSubBuckets equal buckets, so any recorded value is reported
+// within 1/kSubBuckets (about 6%) of its true value, from 0 up to 2^64 - 1,
+// in fixed memory.
+class alignas(64) Histogram
+{
+public:
+    static constexpr unsigned kSubBucketBits = 4;
+    static constexpr std::size_t kSubBuckets = std::size_t(1) << kSubBucketBits;
+    static constexpr std::size_t kBuckets = (64 - kSubBucketBits + 1) * kSubBuckets;
+
+    void record(std::uint64_t value) noexcept
+    {
+        buckets_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+        std::uint64_t max = max_.load(std::memory_order_relaxed);
+        while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Add every sample of `other`, which must not be recorded into meanwhile
+    // for an exact result.
+    void merge(const Histogram &other) noexcept;
+
+    std::uint64_t count() const noexcept { return count_.load(std::memory_order_relaxed); }
+    std::uint64_t sum() const noexcept { return sum_.load(std::memory_order_relaxed); }
+    std::uint64_t max() const noexcept { return max_.load(std::memory_order_relaxed); }
+
+    // Value at or below which `percent` of the samples fall, as the midpoint
+    // of its bucket (exact below kSubBuckets, and the maximum for the last
+    // sample). 0 when nothing was recorded.
+    std::uint64_t percentile(double percent) const noexcept;
+
+    static std::size_t bucket_of(std::uint64_t value) noexcept
+    {
+        if (value < kSubBuckets)
+            return static_cast<std::size_t>(value);
+        unsigned exponent = 63 - count_leading_zeros(value); // >= kSubBucketBits
+        unsigned shift = exponent - kSubBucketBits;
+        std::size_t sub = static_cast<std::size_t>(value >> shift) & (kSubBuckets - 1);
+        return (shift + 1) * kSubBuckets + sub;
+    }
+
+private:
+    static unsigned count_leading_zeros(std::uint64_t value) noexcept
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return static_cast<unsigned>(__builtin_clzll(value));
+#else
+        unsigned n = 0;
+        for (std::uint64_t bit = std::uint64_t(1) << 63; (value & bit) == 0; bit >>= 1)
+            ++n;
+        return n;
+#endif
+    }
+
+    std::array<std::atomic<std::uint64_t>, kBuckets> buckets_{};
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> sum_{0};
+    std::atomic<std::uint64_t> max_{0};
+};
+
+class MetricsRegistry
+{
+public:
+    // Find or create the metric `name`. References stay valid for the life of
+    // the registry. Takes a lock: look metrics up once, not per event.
+    Counter &counter(const std::string &name);
+    Gauge &gauge(const std::string &name);
+    Histogram &histogram(const std::string &name);
+
+    // Create a new shard of the metric `name` for one thread to record into.
+    // It is reported together with counter(name) and every other shard.
+    Counter &counter_shard(const std::string &name);
+    Gauge &gauge_shard(const std::string &name);
+    Histogram &histogram_shard(const std::string &name);
+
+    // Every metric, one per line and sorted by name:
+    //
+    //     counter requests 1234
+    //     gauge connections_open 12
+    //     histogram request_ns count=1234 mean=850 p50=790 p90=1100 p99=2300 p99.9=5100 max=9000
+    std::string render_text() const;
+
+private:
+    // The first instance of each name is the shared one; the rest are shards.
+    template <typename Metric>
+    using Shards = std::map<std::string, std::vector<std::unique_ptr<Metric>>>;
+
+    mutable std::mutex mutex_;
+    Shards<Counter> counters_;
+    Shards<Gauge> gauges_;
+    Shards<Histogram> histograms_;
+};
+
+// The registry the greet library and greet_world record into.
+MetricsRegistry &metrics();
+
+// Whether latency metrics are recorded. Off by default; greet_world turns it
+// on for --stats before it starts work. Code that times an operation checks
+// this once, when it looks its metrics up.
+bool metrics_timing_enabled() noexcept;
+void enable_metrics_timing(bool enabled) noexcept;
@@ -0,0 +1,136 @@
+#include "output.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "trace.h"
+
+FlushPolicy parse_flush_policy(std::string_view name)
+{
+    if (name == "line")
+        return FlushPolicy::Line;
+    if (name == "block")
+        return FlushPolicy::Block;
+    if (name == "none")
+        return FlushPolicy::None;
+    throw std::invalid_argument("unknown flush policy \"" + std::string(name) + "\" (expected line, block or none)");
+}
+
+void write_all(int fd, const char *data, std::size_t size)
+{
+    GREET_TRACE_SCOPE("write");
+    while (size > 0)
+    {
+#ifdef _WIN32
+        int n = _write(fd, data, static_cast<unsigned>(size > 0x40000000 ? 0x40000000 : size));
+#else
+        ssize_t n = ::write(fd, data, size);
+#endif
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "write");
+        }
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+}
+
+OutputWriter::OutputWriter(int fd, FlushPolicy policy, std::size_t capacity)
+    : fd_(fd), policy_(policy), buffer_(capacity < kBlockSize ? kBlockSize : capacity),
+      write_ns_(metrics_timing_enabled() ? &metrics().histogram("write_ns") : nullptr),
+      bytes_counter_(write_ns_ != nullptr ? &metrics().counter("bytes_written") : nullptr)
+{
+}
+
+OutputWriter::~OutputWriter()
+{
+    try
+    {
+        flush();
+    }
+    catch (const std::system_error &)
+    {
+        // Nothing sensible to do with a failed write while unwinding.
+    }
+}
+
+void OutputWriter::write(std::string_view data)
+{
+    if (data.size() > buffer_.size() - used_)
+    {
+        flush();
+        if (data.size() >= buffer_.size())
+        {
+            emit(data.data(), data.size());
+            bytes_written_ += data.size();
+            return;
+        }
+    }
+    std::memcpy(buffer_.data() + used_, data.data(), data.size());
+    used_ += data.size();
+    apply_policy(!data.empty() && data.back() == '\n');
+}
+
+char *OutputWriter::prepare(std::size_t size)
+{
+    if (size > buffer_.size() - used_)
+    {
+        flush();
+        if (size > buffer_.size())
+            buffer_.resize(size);
+    }
+    return buffer_.data() + used_;
+}
+
+void OutputWriter::commit(std::size_t size)
+{
+    used_ += size;
+    apply_policy(size > 0 && buffer_[used_ - 1] == '\n');
+}
+
+void OutputWriter::emit(const char *data, std::size_t size)
+{
+    if (write_ns_ == nullptr)
+    {
+        write_all(fd_, data, size);
+        return;
+    }
+    auto start = std::chrono::steady_clock::now();
+    write_all(fd_, data, size);
+    write_ns_->record(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count()));
+    bytes_counter_->add(size);
+}
+
+void OutputWriter::apply_policy(bool line_end)
+{
+    if ((policy_ == FlushPolicy::Line && line_end) || (policy_ == FlushPolicy::Block && used_ >= kBlockSize))
+        flush();
+}
+
+void OutputWriter::write_line(std::string_view line)
+{
+    write(line);
+    write(std::string_view("\n", 1));
+}
+
+void OutputWriter::flush()
+{
+    if (used_ == 0)
+        return;
+    emit(buffer_.data(), used_);
+    bytes_written_ += used_;
+    used_ = 0;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "metrics.h"
+
+// When an OutputWriter hands its buffered bytes to the OS.
+enum class FlushPolicy
+{
+    Line,  // after every write that ends a line
+    Block, // whenever a full block (kBlockSize bytes) is buffered
+    None,  // only when the buffer is full and on flush()/destruction
+};
+
+// Parse "line", "block" or "none". Throws std::invalid_argument otherwise.
+FlushPolicy parse_flush_policy(std::string_view name);
+
+// Buffered writer to a file descriptor, bypassing iostreams. Throws
+// std::system_error if the descriptor cannot be written.
+class OutputWriter
+{
+public:
+    // Pipe-sized blocks keep a reader on the other end of a pipe busy.
+    static constexpr std::size_t kBlockSize = 64 * 1024;
+    static constexpr std::size_t kDefaultCapacity = 1024 * 1024;
+
+    explicit OutputWriter(int fd, FlushPolicy policy = FlushPolicy::Block,
+                          std::size_t capacity = kDefaultCapacity);
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter &) = delete;
+    OutputWriter &operator=(const OutputWriter &) = delete;
+
+    void write(std::string_view data);
+    void write_line(std::string_view line);
+    void flush();
+
+    // Return space for at least `size` bytes to render into directly; make
+    // them part of the output with commit(). Avoids a copy through a scratch
+    // buffer.
+    char *prepare(std::size_t size);
+    void commit(std::size_t size);
+
+    // Bytes handed to the descriptor so far; excludes anything still buffered.
+    std::uint64_t bytes_written() const { return bytes_written_; }
+
+private:
+    // Hand `size` bytes to the descriptor. When metrics timing was enabled at
+    // construction, the write is also recorded in the write_ns histogram and
+    // bytes_written counter (metrics.h).
+    void emit(const char *data, std::size_t size);
+    void apply_policy(bool line_end);
+
+    int fd_;
+    FlushPolicy policy_;
+    std::vector<char> buffer_;
+    std::size_t used_ = 0;
+    std::uint64_t bytes_written_ = 0;
+    Histogram *write_ns_;    // null: not recording
+    Counter *bytes_counter_; // null: not recording
+};
+
+// Write all of `data` to `fd`, retrying short writes. Throws std::system_error.
+void write_all(int fd, const char *data, std::size_t size);
@@ -0,0 +1,741 @@
+#include "server.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "greet.h"
+#include "http.h"
+#include "metrics.h"
+#include "shm_channel.h"
+#include "trace.h"
+
+namespace
+{
+// Longest request line accepted before the connection is dropped.
+constexpr std::size_t kMaxRequest = 64 * 1024;
+constexpr std::size_t kReadSize = 64 * 1024;
+constexpr int kMaxEvents = 256;
+// A client that keeps the socket full gets at most this many reads per wakeup,
+// and reading stops early once this much output is pending. The loop then
+// serves other connections; level-triggered epoll brings it back.
+constexpr int kMaxReadsPerEvent = 16;
+constexpr std::size_t kOutHighWater = 256 * 1024;
+
+// Set by SIGINT/SIGTERM or a failing reactor. Every reactor also watches
+// g_wake_fd, so writing to it interrupts all of their epoll_wait calls.
+std::atomic<bool> g_stop{false};
+int g_wake_fd = -1;
+
+void request_stop()
+{
+    g_stop = true;
+    std::uint64_t one = 1;
+    if (g_wake_fd >= 0)
+    {
+        ssize_t ignored = ::write(g_wake_fd, &one, sizeof(one));
+        (void)ignored;
+    }
+}
+
+void on_signal(int)
+{
+    request_stop();
+}
+
+[[noreturn]] void throw_errno(const std::string &what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Log a problem the server carries on from. Best effort: a failed write to
+// stderr is ignored.
+void warn(const std::string &message)
+{
+    std::string line = "greet_world: " + message + "\n";
+    ssize_t ignored = ::write(2, line.data(), line.size());
+    (void)ignored;
+}
+
+// Tens of thousands of connections need more descriptors than the usual soft
+// limit of 1024.
+void raise_fd_limit()
+{
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+int listen_unix(const std::string &path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("unix socket path \"" + path + "\" is empty or too long");
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    // Replace a socket left behind by a previous run, but never other files.
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+        ::unlink(path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw_errno("socket");
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+    }
+    return fd;
+}
+
+// With SO_REUSEPORT every reactor binds its own listener to the same port
+// and the kernel spreads incoming connections across them.
+int listen_tcp_localhost(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw_errno("socket");
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<std::uint16_t>(port));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "127.0.0.1:" + std::to_string(port));
+    }
+    return fd;
+}
+
+enum class Protocol
+{
+    Line,
+    Http,
+};
+
+std::uint64_t elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+// The metrics text (metrics.h) for a transport whose messages hold at most
+// `limit` bytes, cut after the last whole line that fits.
+std::string stats_text(std::size_t limit)
+{
+    std::string text = metrics().render_text();
+    if (text.size() > limit)
+    {
+        std::size_t nl = text.rfind('\n', limit - 1);
+        text.resize(nl == std::string::npos ? 0 : nl + 1);
+    }
+    return text;
+}
+
+// Answer every complete request line in `in`, appending the responses to
+// `out` and counting them in `answered`. The line `/stats` is answered with
+// the metrics text and an empty line. Returns the number of bytes consumed.
+std::size_t handle_lines(std::string_view in, std::string &out, const GreetTemplate &tmpl, std::uint64_t &answered)
+{
+    std::size_t consumed = 0;
+    for (;;)
+    {
+        std::size_t nl = in.find('\n', consumed);
+        if (nl == std::string_view::npos)
+            return consumed;
+        std::string_view name = in.substr(consumed, nl - consumed);
+        if (!name.empty() && name.back() == '\r')
+            name.remove_suffix(1);
+        if (name.empty())
+            out.append(greet_view());
+        else if (name == "/stats")
+            out += metrics().render_text();
+        else
+            tmpl.render(name, out);
+        out += '\n';
+        consumed = nl + 1;
+        ++answered;
+    }
+}
+
+struct Connection
+{
+    explicit Connection(Protocol p) : protocol(p) {}
+
+    Protocol protocol;
+    std::string in;
+    std::string out;
+    std::size_t out_pos = 0;
+    bool writing = false;           // registered for EPOLLOUT
+    bool close_after_write = false; // stop reading; close once `out` is sent
+};
+
+struct Listener
+{
+    int fd;
+    Protocol protocol;
+};
+
+class Reactor
+{
+public:
+    explicit Reactor(const GreetTemplate &tmpl)
+        : tmpl_(tmpl), http_(tmpl), accepted_(metrics().counter_shard("connections_accepted")),
+          open_(metrics().gauge_shard("connections_open")), requests_(metrics().counter_shard("requests")),
+          request_ns_(metrics_timing_enabled() ? &metrics().histogram_shard("request_ns") : nullptr)
+    {
+        epoll_ = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_ < 0)
+            throw_errno("epoll_create1");
+        spare_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+
+    ~Reactor()
+    {
+        for (std::size_t fd = 0; fd < connections_.size(); ++fd)
+        {
+            if (connections_[fd])
+            {
+                ::close(static_cast<int>(fd));
+                open_.add(-1);
+            }
+        }
+        ::close(epoll_);
+        if (spare_fd_ >= 0)
+            ::close(spare_fd_);
+    }
+
+    Reactor(const Reactor &) = delete;
+    Reactor &operator=(const Reactor &) = delete;
+
+    // `shared` listeners are watched by several reactors; EPOLLEXCLUSIVE
+    // wakes only one of them per incoming connection.
+    void add_listener(int fd, Protocol protocol, bool shared)
+    {
+        listeners_.push_back({fd, protocol});
+        watch(fd, shared ? EPOLLIN | EPOLLEXCLUSIVE : EPOLLIN, EPOLL_CTL_ADD);
+    }
+
+    void run()
+    {
+        watch(g_wake_fd, EPOLLIN, EPOLL_CTL_ADD);
+        epoll_event events[kMaxEvents];
+        while (!g_stop)
+        {
+            int n = epoll_wait(epoll_, events, kMaxEvents, -1);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw_errno("epoll_wait");
+            }
+            for (int i = 0; i < n; ++i)
+            {
+                int fd = events[i].data.fd;
+                if (fd == g_wake_fd)
+                    continue;
+                if (const Listener *listener = find_listener(fd))
+                    accept_all(*listener);
+                else if (events[i].events & (EPOLLERR | EPOLLHUP))
+                    close_connection(fd);
+                else if (events[i].events & EPOLLIN)
+                    on_readable(fd);
+                else if (events[i].events & EPOLLOUT)
+                    on_writable(fd);
+            }
+        }
+    }
+
+private:
+    void watch(int fd, std::uint32_t events, int op)
+    {
+        epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_, op, fd, &ev) != 0)
+            throw_errno("epoll_ctl");
+    }
+
+    const Listener *find_listener(int fd) const
+    {
+        for (const Listener &listener : listeners_)
+        {
+            if (listener.fd == fd)
+                return &listener;
+        }
+        return nullptr;
+    }
+
+    void accept_all(const Listener &listener)
+    {
+        for (;;)
+        {
+            int fd = accept4(listener.fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                    continue;
+                if ((errno == EMFILE || errno == ENFILE) && shed_connection(listener.fd))
+                    continue;
+                if (errno != EAGAIN && errno != EWOULDBLOCK)
+                    warn(std::string("accept: ") + std::strerror(errno));
+                return;
+            }
+            if (static_cast<std::size_t>(fd) >= connections_.size())
+                connections_.resize(std::max<std::size_t>(fd + 1, connections_.size() * 2));
+            if (listener.protocol == Protocol::Http)
+            {
+                // Responses are written whole; don't hold them back for Nagle.
+                int on = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            }
+            connections_[fd] = std::make_unique<Connection>(listener.protocol);
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+            accepted_.add();
+            open_.add(1);
+        }
+    }
+
+    // Out of descriptors: the pending connection would keep the level-triggered
+    // listener ready forever. Use the spare descriptor to accept and drop it.
+    bool shed_connection(int listener)
+    {
+        if (spare_fd_ < 0)
+            return false;
+        ::close(spare_fd_);
+        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd >= 0)
+            ::close(fd);
+        spare_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        if (!warned_fd_limit_)
+        {
+            warn("out of file descriptors, dropping new connections");
+            warned_fd_limit_ = true;
+        }
+        return fd >= 0;
+    }
+
+    // request_ns, when timing is on, covers a read's requests from the moment
+    // the read returned until their responses were handed to the socket. At
+    // end of input the pending responses are still sent before the connection
+    // is closed.
+    void on_readable(int fd)
+    {
+        Connection &c = *connections_[fd];
+        char buffer[kReadSize];
+        std::chrono::steady_clock::time_point start;
+        std::uint64_t answered = 0;
+        for (int reads = 0; reads < kMaxReadsPerEvent && c.out.size() < kOutHighWater; ++reads)
+        {
+            ssize_t n;
+            {
+                GREET_TRACE_SCOPE("read");
+                n = ::read(fd, buffer, sizeof(buffer));
+            }
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    break;
+                close_connection(fd);
+                return;
+            }
+            if (n == 0)
+            {
+                c.close_after_write = true;
+                break;
+            }
+
+            if (answered == 0 && request_ns_ != nullptr)
+                start = std::chrono::steady_clock::now();
+
+            // Answer straight from the read buffer when nothing is pending, and
+            // only keep the incomplete tail.
+            std::size_t size = static_cast<std::size_t>(n);
+            if (c.in.empty())
+            {
+                std::size_t consumed = handle(c, std::string_view(buffer, size), answered);
+                c.in.assign(buffer + consumed, size - consumed);
+            }
+            else
+            {
+                c.in.append(buffer, size);
+                c.in.erase(0, handle(c, c.in, answered));
+            }
+            if (c.close_after_write)
+                break;
+            if (c.in.size() > kMaxRequest)
+            {
+                close_connection(fd);
+                return;
+            }
+            if (size < sizeof(buffer))
+                break;
+        }
+        on_writable(fd);
+        if (answered != 0)
+        {
+            requests_.add(answered);
+            if (request_ns_ != nullptr)
+                request_ns_->record(elapsed_ns(start));
+        }
+    }
+
+    std::size_t handle(Connection &c, std::string_view in, std::uint64_t &answered)
+    {
+        GREET_TRACE_SCOPE("render");
+        if (c.protocol == Protocol::Line)
+            return handle_lines(in, c.out, tmpl_, answered);
+        std::uint64_t before = http_.requests();
+        std::size_t consumed = http_.handle(in, c.out, c.close_after_write);
+        answered += http_.requests() - before;
+        return consumed;
+    }
+
+    void on_writable(int fd)
+    {
+        GREET_TRACE_SCOPE("write");
+        Connection &c = *connections_[fd];
+        while (c.out_pos < c.out.size())
+        {
+            ssize_t n = ::send(fd, c.out.data() + c.out_pos, c.out.size() - c.out_pos, MSG_NOSIGNAL);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    // Stop reading while a response is stuck, so a client that
+                    // never reads cannot make us buffer without bound.
+                    if (!c.writing)
+                    {
+                        watch(fd, EPOLLOUT, EPOLL_CTL_MOD);
+                        c.writing = true;
+                    }
+                    return;
+                }
+                close_connection(fd);
+                return;
+            }
+            c.out_pos += static_cast<std::size_t>(n);
+        }
+        c.out.clear();
+        c.out_pos = 0;
+        if (c.close_after_write)
+        {
+            close_connection(fd);
+            return;
+        }
+        if (c.writing)
+        {
+            watch(fd, EPOLLIN, EPOLL_CTL_MOD);
+            c.writing = false;
+        }
+    }
+
+    void close_connection(int fd)
+    {
+        connections_[fd].reset();
+        ::close(fd);
+        open_.add(-1);
+    }
+
+    const GreetTemplate &tmpl_;
+    HttpGreeter http_;
+    // This reactor's own shards (metrics.h), so reactors share no counters.
+    Counter &accepted_;
+    Gauge &open_;
+    Counter &requests_;
+    Histogram *request_ns_; // null unless timing is enabled
+    int epoll_ = -1;
+    int spare_fd_ = -1;
+    bool warned_fd_limit_ = false;
+    std::vector<Listener> listeners_;
+    std::vector<std::unique_ptr<Connection>> connections_;
+};
+} // namespace
+
+void run_server(const ServerOptions &options, const GreetTemplate &tmpl)
+{
+    if (options.unix_path.empty() && options.http_port == 0)
+        throw std::invalid_argument("run_server: nothing to listen on");
+    unsigned reactors = options.reactors == 0 ? 1 : options.reactors;
+    raise_fd_limit();
+
+    g_stop = false;
+    g_wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (g_wake_fd < 0)
+        throw_errno("eventfd");
+    std::signal(SIGPIPE, SIG_IGN);
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    // One Unix listener shared by every reactor, one TCP listener each.
+    std::vector<int> fds;
+    int unix_fd = -1;
+    std::vector<int> http_fds;
+    auto cleanup = [&]() {
+        for (int fd : fds)
+            ::close(fd);
+        if (!options.unix_path.empty())
+            ::unlink(options.unix_path.c_str());
+        ::close(g_wake_fd);
+        g_wake_fd = -1;
+    };
+
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto run_reactor = [&](unsigned index) {
+        try
+        {
+            if (options.pin_cpus)
+            {
+                unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(index % cpus, &set);
+                pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            }
+            Reactor reactor(tmpl);
+            if (unix_fd >= 0)
+                reactor.add_listener(unix_fd, Protocol::Line, reactors > 1);
+            if (!http_fds.empty())
+                reactor.add_listener(http_fds[index], Protocol::Http, false);
+            reactor.run();
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+                error = std::current_exception();
+            request_stop();
+        }
+    };
+
+    try
+    {
+        if (!options.unix_path.empty())
+        {
+            unix_fd = listen_unix(options.unix_path);
+            fds.push_back(unix_fd);
+        }
+        for (unsigned i = 0; options.http_port != 0 && i < reactors; ++i)
+        {
+            http_fds.push_back(listen_tcp_localhost(options.http_port));
+            fds.push_back(http_fds.back());
+        }
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 1; i < reactors; ++i)
+            threads.emplace_back(run_reactor, i);
+        run_reactor(0);
+        for (std::thread &thread : threads)
+            thread.join();
+    }
+    catch (...)
+    {
+        cleanup();
+        throw;
+    }
+    cleanup();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+void run_shm_service(const std::string &name, const GreetTemplate &tmpl, unsigned spins)
+{
+    g_stop = false;
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    ShmChannel channel = ShmChannel::create(name);
+    channel.set_spin(spins);
+    Counter &requests = metrics().counter("requests");
+    Histogram *request_ns = metrics_timing_enabled() ? &metrics().histogram("request_ns") : nullptr;
+    std::string request;
+    std::string response;
+    // Receives block until a request arrives, so only rendering and sending
+    // are traced and timed.
+    while (channel.receive_request(request, &g_stop))
+    {
+        std::chrono::steady_clock::time_point start;
+        if (request_ns != nullptr)
+            start = std::chrono::steady_clock::now();
+        {
+            GREET_TRACE_SCOPE("render");
+            response.clear();
+            if (request.empty())
+                response.append(greet_view());
+            else if (request == "/stats")
+                response = stats_text(ShmChannel::kMaxMessage);
+            else
+                tmpl.render(request, response);
+        }
+        {
+            GREET_TRACE_SCOPE("write");
+            channel.send_response(response);
+        }
+        requests.add();
+        if (request_ns != nullptr)
+            request_ns->record(elapsed_ns(start));
+    }
+}
+
+void run_udp_service(int port, const GreetTemplate &tmpl, unsigned batch)
+{
+    constexpr std::size_t kDatagramSize = 2048;
+    if (batch == 0)
+        batch = 1;
+    g_stop = false;
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw_errno("socket");
+    struct FdCloser
+    {
+        int fd;
+        ~FdCloser() { ::close(fd); }
+    } closer{fd};
+
+    // A receive timeout lets the loop notice a stop request.
+    timeval timeout{0, 200 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    int buffer_size = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer_size, sizeof(buffer_size));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buffer_size, sizeof(buffer_size));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<std::uint16_t>(port));
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        throw std::system_error(errno, std::generic_category(), "127.0.0.1:" + std::to_string(port));
+
+    std::vector<char> in_buffers(batch * kDatagramSize);
+    std::vector<char> out_buffers(batch * kDatagramSize);
+    std::vector<sockaddr_in> peers(batch);
+    std::vector<iovec> in_iov(batch), out_iov(batch);
+    std::vector<mmsghdr> in_msgs(batch), out_msgs(batch);
+    for (unsigned i = 0; i < batch; ++i)
+    {
+        in_iov[i] = {in_buffers.data() + i * kDatagramSize, kDatagramSize};
+        std::memset(&in_msgs[i], 0, sizeof(mmsghdr));
+        in_msgs[i].msg_hdr.msg_iov = &in_iov[i];
+        in_msgs[i].msg_hdr.msg_iovlen = 1;
+        in_msgs[i].msg_hdr.msg_name = &peers[i];
+    }
+
+    Counter &datagrams = metrics().counter("udp_datagrams");
+    Counter &truncated = metrics().counter("udp_truncated");
+    Histogram &batch_sizes = metrics().histogram("udp_batch");
+    while (!g_stop)
+    {
+        for (unsigned i = 0; i < batch; ++i)
+            in_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        // Block for the first datagram, then take whatever else is queued.
+        int n = recvmmsg(fd, in_msgs.data(), batch, MSG_WAITFORONE, nullptr);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+                continue;
+            throw_errno("recvmmsg");
+        }
+
+        GREET_TRACE_SCOPE("batch");
+        datagrams.add(static_cast<std::uint64_t>(n));
+        batch_sizes.record(static_cast<std::uint64_t>(n));
+        unsigned replies = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            GREET_TRACE_SCOPE("render");
+            if (in_msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                // Longer than the buffer: greeting what fit would greet the wrong name.
+                truncated.add();
+                continue;
+            }
+            std::string_view name(in_buffers.data() + i * kDatagramSize, in_msgs[i].msg_len);
+            char *out = out_buffers.data() + replies * kDatagramSize;
+            std::size_t size;
+            if (name == "/stats")
+            {
+                std::string text = stats_text(kDatagramSize);
+                std::memcpy(out, text.data(), text.size());
+                size = text.size();
+            }
+            else
+            {
+                size = name.empty() ? greet(out, kDatagramSize) : tmpl.render(name, out, kDatagramSize);
+            }
+            if (size > kDatagramSize)
+                continue; // does not fit in a datagram buffer; drop it
+            out_iov[replies] = {out, size};
+            std::memset(&out_msgs[replies], 0, sizeof(mmsghdr));
+            out_msgs[replies].msg_hdr.msg_iov = &out_iov[replies];
+            out_msgs[replies].msg_hdr.msg_iovlen = 1;
+            out_msgs[replies].msg_hdr.msg_name = &peers[i];
+            out_msgs[replies].msg_hdr.msg_namelen = in_msgs[i].msg_hdr.msg_namelen;
+            ++replies;
+        }
+
+        // Fire and forget: a reply the kernel refuses is dropped like any
+        // other lost datagram.
+        GREET_TRACE_SCOPE("write");
+        unsigned sent = 0;
+        while (sent < replies)
+        {
+            int m = sendmmsg(fd, out_msgs.data() + sent, replies - sent, 0);
+            if (m < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                ++sent;
+                continue;
+            }
+            sent += static_cast<unsigned>(m);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <string>
+
+#include "greet_template.h"
+
+// Where and how greet_world listens in its server modes (Linux only).
+struct ServerOptions
+{
+    // Path of the Unix domain socket to listen on, if any. A stale socket left
+    // at the path by an earlier run is replaced.
+    std::string unix_path;
+    // Localhost TCP port for the HTTP endpoint; 0 disables it.
+    int http_port = 0;
+    // Number of event loops, each on its own thread with its own connections.
+    // Each binds its own HTTP listener with SO_REUSEPORT; the Unix listener is
+    // shared. Only the read-only greeting data is shared between them.
+    unsigned reactors = 1;
+    // Pin reactor i to CPU i (modulo the CPU count).
+    bool pin_cpus = false;
+};
+
+// Serve greetings until SIGINT or SIGTERM from non-blocking epoll loops. On
+// the Unix socket, requests are framed one per line: an empty line asks for
+// the default greeting and any other line is a name to greet with `tmpl`, and
+// each response is the greeting followed by "\n". The line `/stats` instead
+// gets the metrics text (metrics.h) followed by an empty line. The HTTP
+// endpoint is described in http.h. Pipelined requests are answered in order
+// on both. Throws std::system_error if a listener cannot be set up.
+void run_server(const ServerOptions &options, const GreetTemplate &tmpl);
+
+// Serve greetings over the shared-memory channel `name` (see shm_channel.h)
+// until SIGINT or SIGTERM. Requests use the same framing as the Unix socket
+// without the trailing newline: empty for the default greeting, `/stats` for
+// the metrics text, otherwise a name. `spins` is how long each wait busy-polls
+// before sleeping.
+void run_shm_service(const std::string &name, const GreetTemplate &tmpl, unsigned spins);
+
+// Answer greeting datagrams on 127.0.0.1:`port` until SIGINT or SIGTERM. Each
+// datagram is a request with the same framing as run_shm_service() and gets
+// one datagram back; the metrics text is cut to the whole lines that fit. Up to `batch` datagrams are received with a single
+// recvmmsg() and answered with a single sendmmsg(); responses are rendered
+// into buffers allocated once up front.
+void run_udp_service(int port, const GreetTemplate &tmpl, unsigned batch);
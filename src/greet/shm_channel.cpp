@@ -0,0 +1,291 @@
+#include "shm_channel.h"
+
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr std::uint32_t kMagic = 0x47524554; // "GRET"
+constexpr std::uint32_t kVersion = 2;
+// Record length marking the unused end of the ring; the reader skips to the
+// start.
+constexpr std::uint32_t kWrapMarker = UINT32_MAX;
+
+// Every record starts with the message length and the session id.
+struct RecordHeader
+{
+    std::uint32_t length;
+    std::uint32_t session;
+};
+
+std::size_t record_size(std::size_t length)
+{
+    return (sizeof(RecordHeader) + length + 3) & ~std::size_t(3);
+}
+
+[[noreturn]] void corrupted(const std::string &name)
+{
+    throw std::runtime_error(name + ": corrupted channel");
+}
+
+bool process_alive(std::uint32_t pid)
+{
+    return ::kill(static_cast<pid_t>(pid), 0) == 0 || errno != ESRCH;
+}
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shared-memory rings need lock-free atomics");
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "shared-memory rings need lock-free atomics");
+
+void futex_wait(std::atomic<std::uint32_t> &word, std::uint32_t expected)
+{
+    // Bounded sleeps let the service notice a stop request.
+    timespec timeout{0, 100 * 1000 * 1000};
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+void futex_wake(std::atomic<std::uint32_t> &word)
+{
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+std::string segment_name(const std::string &name)
+{
+    return name.empty() || name[0] != '/' ? "/" + name : name;
+}
+
+// One direction of the channel. `head` and `tail` count bytes ever consumed
+// and produced; `seq` changes on every push and pop so a waiting side can
+// sleep on it.
+struct Ring
+{
+    alignas(64) std::atomic<std::uint64_t> head{0};
+    alignas(64) std::atomic<std::uint64_t> tail{0};
+    alignas(64) std::atomic<std::uint32_t> seq{0};
+    std::atomic<std::uint32_t> sleepers{0};
+    alignas(64) char data[ShmChannel::kRingSize];
+};
+} // namespace
+
+struct ShmChannel::Segment
+{
+    std::uint32_t magic = kMagic;
+    std::uint32_t version = kVersion;
+    std::atomic<std::uint32_t> attached{0}; // pid of the client, 0 when free
+    std::atomic<std::uint32_t> sessions{0}; // last session handed out
+    Ring requests;
+    Ring responses;
+};
+
+ShmChannel::ShmChannel(std::string name, Segment *segment, bool owner, std::uint32_t session)
+    : name_(std::move(name)), segment_(segment), owner_(owner), session_(session)
+{
+}
+
+ShmChannel::ShmChannel(ShmChannel &&other) noexcept
+    : name_(std::move(other.name_)), segment_(other.segment_), owner_(other.owner_), session_(other.session_),
+      spins_(other.spins_)
+{
+    other.segment_ = nullptr;
+}
+
+ShmChannel::~ShmChannel()
+{
+    if (segment_ == nullptr)
+        return;
+    if (owner_)
+    {
+        ::shm_unlink(name_.c_str());
+    }
+    else
+    {
+        std::uint32_t self = static_cast<std::uint32_t>(::getpid());
+        segment_->attached.compare_exchange_strong(self, 0);
+    }
+    ::munmap(segment_, sizeof(Segment));
+}
+
+ShmChannel ShmChannel::create(const std::string &name)
+{
+    std::string path = segment_name(name);
+    ::shm_unlink(path.c_str());
+    int fd = ::shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "shm_open " + path);
+    if (::ftruncate(fd, sizeof(Segment)) != 0)
+    {
+        int err = errno;
+        ::close(fd);
+        ::shm_unlink(path.c_str());
+        throw std::system_error(err, std::generic_category(), "ftruncate " + path);
+    }
+    void *p = ::mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (p == MAP_FAILED)
+    {
+        ::shm_unlink(path.c_str());
+        throw std::system_error(err, std::generic_category(), "mmap " + path);
+    }
+    return ShmChannel(path, new (p) Segment(), true, 0);
+}
+
+ShmChannel ShmChannel::open(const std::string &name)
+{
+    std::string path = segment_name(name);
+    int fd = ::shm_open(path.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "shm_open " + path);
+    void *p = ::mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int err = errno;
+    ::close(fd);
+    if (p == MAP_FAILED)
+        throw std::system_error(err, std::generic_category(), "mmap " + path);
+
+    Segment *segment = static_cast<Segment *>(p);
+    if (segment->magic != kMagic || segment->version != kVersion)
+    {
+        ::munmap(p, sizeof(Segment));
+        throw std::runtime_error(path + ": not a greeting channel");
+    }
+    // Take the channel if it is free or its client has died.
+    std::uint32_t self = static_cast<std::uint32_t>(::getpid());
+    std::uint32_t owner = 0;
+    while (!segment->attached.compare_exchange_strong(owner, self))
+    {
+        if (process_alive(owner))
+        {
+            ::munmap(p, sizeof(Segment));
+            throw std::runtime_error(path + ": another client is attached");
+        }
+    }
+    return ShmChannel(path, segment, false, segment->sessions.fetch_add(1) + 1);
+}
+
+bool ShmChannel::receive_response(std::string &message)
+{
+    // Responses to a dead client's requests may still be queued; skip them.
+    std::uint32_t session;
+    do
+    {
+        if (!pop(false, message, session))
+            return false;
+    } while (session != session_);
+    return true;
+}
+
+void ShmChannel::push(bool requests, std::string_view message, std::uint32_t session)
+{
+    if (message.size() > kMaxMessage)
+        throw std::invalid_argument("shared-memory message too long");
+    Ring &ring = requests ? segment_->requests : segment_->responses;
+    RecordHeader header{static_cast<std::uint32_t>(message.size()), session};
+
+    // Records are 4-byte aligned and never wrap; a record that would run past
+    // the end is preceded by a wrap marker.
+    std::size_t record = record_size(message.size());
+    std::uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    if (tail % 4 != 0)
+        corrupted(name_);
+    std::size_t offset = tail % kRingSize;
+    std::size_t pad = offset + record > kRingSize ? kRingSize - offset : 0;
+
+    for (unsigned spins = 0;;)
+    {
+        std::uint32_t seq = ring.seq.load(std::memory_order_acquire);
+        std::uint64_t head = ring.head.load(std::memory_order_acquire);
+        if (head > tail || tail - head > kRingSize)
+            corrupted(name_);
+        if (tail + pad + record - head <= kRingSize)
+            break;
+        if (spins < spins_)
+        {
+            ++spins;
+            continue;
+        }
+        ring.sleepers.fetch_add(1);
+        futex_wait(ring.seq, seq);
+        ring.sleepers.fetch_sub(1);
+    }
+
+    if (pad != 0)
+    {
+        std::memcpy(ring.data + offset, &kWrapMarker, sizeof(kWrapMarker));
+        tail += pad;
+        offset = 0;
+    }
+    std::memcpy(ring.data + offset, &header, sizeof(header));
+    std::memcpy(ring.data + offset + sizeof(header), message.data(), message.size());
+    ring.tail.store(tail + record, std::memory_order_release);
+    // seq_cst orders the bump before the sleepers check; see the waiters.
+    ring.seq.fetch_add(1);
+    if (ring.sleepers.load() != 0)
+        futex_wake(ring.seq);
+}
+
+bool ShmChannel::pop(bool requests, std::string &message, std::uint32_t &session, const std::atomic<bool> *stop)
+{
+    Ring &ring = requests ? segment_->requests : segment_->responses;
+    std::uint64_t head = ring.head.load(std::memory_order_relaxed);
+    std::uint64_t tail;
+
+    for (unsigned spins = 0;;)
+    {
+        std::uint32_t seq = ring.seq.load(std::memory_order_acquire);
+        tail = ring.tail.load(std::memory_order_acquire);
+        if (tail != head)
+            break;
+        if (stop != nullptr && stop->load())
+            return false;
+        if (spins < spins_)
+        {
+            ++spins;
+            continue;
+        }
+        ring.sleepers.fetch_add(1);
+        futex_wait(ring.seq, seq);
+        ring.sleepers.fetch_sub(1);
+    }
+
+    // The other process writes `tail` and the record, so neither is trusted:
+    // the record must lie within the ring and within what was produced.
+    if (head % 4 != 0 || tail - head > kRingSize)
+        corrupted(name_);
+    std::size_t offset = head % kRingSize;
+    RecordHeader header;
+    std::memcpy(&header.length, ring.data + offset, sizeof(header.length));
+    if (header.length == kWrapMarker)
+    {
+        std::size_t skip = kRingSize - offset;
+        if (tail - head < skip + sizeof(header))
+            corrupted(name_);
+        head += skip;
+        offset = 0;
+    }
+    else if (offset + sizeof(header) > kRingSize)
+    {
+        corrupted(name_);
+    }
+    std::memcpy(&header, ring.data + offset, sizeof(header));
+    std::size_t record = record_size(header.length);
+    if (header.length > kMaxMessage || offset + record > kRingSize || tail - head < record)
+        corrupted(name_);
+    message.assign(ring.data + offset + sizeof(header), header.length);
+    session = header.session;
+    ring.head.store(head + record, std::memory_order_release);
+    // seq_cst orders the bump before the sleepers check; see the waiters.
+    ring.seq.fetch_add(1);
+    if (ring.sleepers.load() != 0)
+        futex_wake(ring.seq);
+    return true;
+}
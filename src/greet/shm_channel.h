@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// A request/response channel in a POSIX shared-memory segment (Linux only),
+// for producers on the same host that want to skip the socket layer. The
+// segment holds two single-producer single-consumer byte rings: requests from
+// the attached client to greet_world and responses back. Messages are
+// length-prefixed. A waiting side spins for a while and then sleeps on a futex.
+//
+// One client is attached at a time; open() fails while another is attached.
+// The segment records the client's pid, so a client that died without
+// detaching is replaced by the next open(). Each attachment is a new session:
+// requests carry its id, the service echoes it, and a client skips responses
+// meant for an earlier session.
+//
+// Everything read from the segment is checked; a record that does not fit the
+// ring is reported as a corrupted channel (std::runtime_error).
+class ShmChannel
+{
+public:
+    static constexpr std::size_t kRingSize = 1 << 20;
+    // Messages longer than this are rejected.
+    static constexpr std::size_t kMaxMessage = 64 * 1024;
+
+    // Create (replacing any existing segment) the channel `name`, as the
+    // service. Throws std::system_error.
+    static ShmChannel create(const std::string &name);
+    // Attach to the channel `name` as its client. Throws std::system_error, or
+    // std::runtime_error if another live client is attached.
+    static ShmChannel open(const std::string &name);
+
+    ShmChannel(ShmChannel &&other) noexcept;
+    ShmChannel &operator=(ShmChannel &&) = delete;
+    ~ShmChannel();
+
+    // How many times a waiting side polls before sleeping on the futex. 0
+    // sleeps immediately; a large value busy-polls for the lowest latency.
+    void set_spin(unsigned spins) { spins_ = spins; }
+
+    // Client side: send a request and receive its response.
+    void send_request(std::string_view message) { push(true, message, session_); }
+    bool receive_response(std::string &message);
+
+    // Service side: receive a request and send its response. receive_request()
+    // returns false if `stop` becomes true while waiting.
+    bool receive_request(std::string &message, const std::atomic<bool> *stop = nullptr)
+    {
+        return pop(true, message, session_, stop);
+    }
+    void send_response(std::string_view message) { push(false, message, session_); }
+
+private:
+    struct Segment;
+
+    ShmChannel(std::string name, Segment *segment, bool owner, std::uint32_t session);
+
+    void push(bool requests, std::string_view message, std::uint32_t session);
+    bool pop(bool requests, std::string &message, std::uint32_t &session, const std::atomic<bool> *stop = nullptr);
+
+    std::string name_;
+    Segment *segment_ = nullptr;
+    bool owner_ = false;
+    // Client: its own session. Service: the session of the last request.
+    std::uint32_t session_ = 0;
+    unsigned spins_ = 1000;
+};
@@ -0,0 +1,103 @@
+#include "trace.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <vector>
+
+std::atomic<bool> g_tracing{false};
+
+namespace
+{
+struct Event
+{
+    const char *name;
+    std::uint64_t start_ns;
+    std::uint64_t end_ns;
+};
+
+// One thread's spans. Only the owning thread writes; `head` counts every span
+// ever recorded, so the newest kCapacity of them are in the ring.
+struct ThreadBuffer
+{
+    static constexpr std::size_t kCapacity = 1 << 16; // power of two
+
+    explicit ThreadBuffer(unsigned id) : tid(id), events(kCapacity) {}
+
+    unsigned tid;
+    std::atomic<std::uint64_t> head{0};
+    std::vector<Event> events;
+};
+
+// Buffers outlive their threads so spans from finished workers still export.
+std::mutex g_buffers_mutex;
+std::vector<std::unique_ptr<ThreadBuffer>> g_buffers;
+std::uint64_t g_epoch_ns = 0;
+thread_local ThreadBuffer *t_buffer = nullptr;
+
+ThreadBuffer &thread_buffer()
+{
+    if (t_buffer == nullptr)
+    {
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        g_buffers.push_back(std::make_unique<ThreadBuffer>(static_cast<unsigned>(g_buffers.size() + 1)));
+        t_buffer = g_buffers.back().get();
+    }
+    return *t_buffer;
+}
+} // namespace
+
+std::uint64_t trace_clock_ns()
+{
+    return static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count());
+}
+
+void trace_record(const char *name, std::uint64_t start_ns, std::uint64_t end_ns)
+{
+    ThreadBuffer &buffer = thread_buffer();
+    std::uint64_t head = buffer.head.load(std::memory_order_relaxed);
+    buffer.events[head & (ThreadBuffer::kCapacity - 1)] = {name, start_ns, end_ns};
+    buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void start_tracing()
+{
+    g_epoch_ns = trace_clock_ns();
+    g_tracing.store(true, std::memory_order_relaxed);
+}
+
+void write_chrome_trace(const std::string &path)
+{
+    std::FILE *file = std::fopen(path.c_str(), "w");
+    if (file == nullptr)
+        throw std::system_error(errno, std::generic_category(), path);
+
+    std::lock_guard<std::mutex> lock(g_buffers_mutex);
+    std::fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    const char *separator = "";
+    for (const std::unique_ptr<ThreadBuffer> &buffer : g_buffers)
+    {
+        std::uint64_t head = buffer->head.load(std::memory_order_acquire);
+        std::uint64_t first = head > ThreadBuffer::kCapacity ? head - ThreadBuffer::kCapacity : 0;
+        std::fprintf(file,
+                     "%s{\"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"name\": \"thread_name\", "
+                     "\"args\": {\"name\": \"thread %u (%llu spans dropped)\"}}",
+                     separator, buffer->tid, buffer->tid, static_cast<unsigned long long>(first));
+        separator = ",\n";
+        for (std::uint64_t i = first; i < head; ++i)
+        {
+            const Event &event = buffer->events[i & (ThreadBuffer::kCapacity - 1)];
+            std::uint64_t start = event.start_ns > g_epoch_ns ? event.start_ns - g_epoch_ns : 0;
+            std::fprintf(file, ",\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"name\": \"%s\", \"ts\": %.3f, \"dur\": %.3f}",
+                         buffer->tid, event.name, start / 1000.0, (event.end_ns - event.start_ns) / 1000.0);
+        }
+    }
+    std::fprintf(file, "\n]}\n");
+    if (std::fclose(file) != 0)
+        throw std::system_error(errno, std::generic_category(), path);
+}
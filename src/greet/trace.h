@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Scoped tracing spans for the hot paths. Mark a stage with
+//
+//     GREET_TRACE_SCOPE("render");
+//
+// which records the time from that line to the end of the enclosing block.
+// Spans only exist in builds configured with GREET_TRACING=ON; otherwise the
+// macro expands to nothing and no tracing code is compiled in.
+//
+// In a tracing build, recording is off until start_tracing() is called, and a
+// disabled span costs one relaxed load. Each thread records into its own
+// fixed-size ring buffer without locks, keeping its most recent spans.
+// write_chrome_trace() exports them as Chrome trace JSON, which
+// chrome://tracing and Perfetto open directly. Span names must be string
+// literals.
+
+#ifdef GREET_TRACING
+
+extern std::atomic<bool> g_tracing;
+
+std::uint64_t trace_clock_ns();
+void trace_record(const char *name, std::uint64_t start_ns, std::uint64_t end_ns);
+
+class TraceSpan
+{
+public:
+    explicit TraceSpan(const char *name) noexcept
+        : name_(name), active_(g_tracing.load(std::memory_order_relaxed)), start_(active_ ? trace_clock_ns() : 0)
+    {
+    }
+    ~TraceSpan()
+    {
+        if (active_)
+            trace_record(name_, start_, trace_clock_ns());
+    }
+    TraceSpan(const TraceSpan &) = delete;
+    TraceSpan &operator=(const TraceSpan &) = delete;
+
+private:
+    const char *name_;
+    bool active_;
+    std::uint64_t start_;
+};
+
+#define GREET_TRACE_CONCAT_(a, b) a##b
+#define GREET_TRACE_CONCAT(a, b) GREET_TRACE_CONCAT_(a, b)
+#define GREET_TRACE_SCOPE(name) TraceSpan GREET_TRACE_CONCAT(greet_trace_span_, __LINE__)(name)
+
+constexpr bool kTracingCompiledIn = true;
+
+// Start recording spans on every thread.
+void start_tracing();
+// Write every recorded span to `path` as Chrome trace JSON. Call it once the
+// traced threads are idle; spans recorded during the export may be torn.
+// Throws std::system_error if the file cannot be written.
+void write_chrome_trace(const std::string &path);
+
+#else
+
+#define GREET_TRACE_SCOPE(name) static_cast<void>(0)
+
+constexpr bool kTracingCompiledIn = false;
+
+inline void start_tracing() {}
+inline void write_chrome_trace(const std::string &) {}
+
+#endif
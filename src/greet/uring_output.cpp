@@ -0,0 +1,276 @@
+#include "uring_output.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr unsigned kQueueDepth = 32;
+
+// Minimal io_uring wrapper over the raw system calls, so the build does not
+// need liburing.
+class Ring
+{
+public:
+    Ring()
+    {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        fd_ = static_cast<int>(syscall(__NR_io_uring_setup, kQueueDepth, &params));
+        if (fd_ < 0)
+            return;
+        if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+        {
+            close();
+            return;
+        }
+
+        sq_entries_ = params.sq_entries;
+        ring_size_ = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                              params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+        ring_ = mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                     IORING_OFF_SQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        void *sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_,
+                          IORING_OFF_SQES);
+        if (ring_ == MAP_FAILED || sqes == MAP_FAILED)
+        {
+            if (sqes != MAP_FAILED)
+                munmap(sqes, sqes_size_);
+            close();
+            return;
+        }
+        sqes_ = static_cast<io_uring_sqe *>(sqes);
+
+        char *base = static_cast<char *>(ring_);
+        sq_tail_ = reinterpret_cast<unsigned *>(base + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned *>(base + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned *>(base + params.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned *>(base + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(base + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned *>(base + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(base + params.cq_off.cqes);
+    }
+
+    ~Ring() { close(); }
+
+    Ring(const Ring &) = delete;
+    Ring &operator=(const Ring &) = delete;
+
+    bool ok() const { return sqes_ != nullptr; }
+    unsigned depth() const { return sq_entries_; }
+
+    // Whether the kernel implements `opcode`. Kernels too old to answer
+    // (before 5.6) also lack IORING_OP_WRITE, so "no" is the right answer
+    // for them too.
+    bool supports(unsigned opcode) const
+    {
+        constexpr unsigned kOps = 256;
+        alignas(io_uring_probe) unsigned char buffer[sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op)];
+        std::memset(buffer, 0, sizeof(buffer));
+        auto *probe = reinterpret_cast<io_uring_probe *>(buffer);
+        if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe, kOps) < 0)
+            return false;
+        return opcode <= probe->last_op && opcode < probe->ops_len &&
+               (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    // Queue a write of `size` bytes at `offset`. Writes queued this way run
+    // concurrently and may complete in any order.
+    void queue_write(int fd, const char *data, unsigned size, std::uint64_t offset, std::uint64_t user_data)
+    {
+        unsigned tail = *sq_tail_;
+        unsigned index = tail & sq_mask_;
+        io_uring_sqe &sqe = sqes_[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_WRITE;
+        sqe.fd = fd;
+        sqe.off = offset;
+        sqe.addr = reinterpret_cast<std::uint64_t>(data);
+        sqe.len = size;
+        sqe.user_data = user_data;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    }
+
+    // Submit `count` queued writes.
+    void submit(unsigned count)
+    {
+        while (count > 0)
+        {
+            long n = syscall(__NR_io_uring_enter, fd_, count, 0, 0, nullptr, 0);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+            }
+            count -= static_cast<unsigned>(n);
+        }
+    }
+
+    // Pop the next completion into `cqe`, if one is ready.
+    bool poll_completion(io_uring_cqe &cqe)
+    {
+        unsigned head = *cq_head_;
+        if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+            return false;
+        cqe = cqes_[head & cq_mask_];
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+    // Pop the next completion, waiting for one if none is ready.
+    io_uring_cqe wait_completion()
+    {
+        io_uring_cqe cqe;
+        while (!poll_completion(cqe))
+        {
+            if (syscall(__NR_io_uring_enter, fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+                throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+        }
+        return cqe;
+    }
+
+private:
+    void close()
+    {
+        if (sqes_ != nullptr)
+            munmap(sqes_, sqes_size_);
+        if (ring_ != nullptr && ring_ != MAP_FAILED)
+            munmap(ring_, ring_size_);
+        if (fd_ >= 0)
+            ::close(fd_);
+        sqes_ = nullptr;
+        ring_ = nullptr;
+        fd_ = -1;
+    }
+
+    int fd_ = -1;
+    unsigned sq_entries_ = 0;
+    void *ring_ = nullptr;
+    std::size_t ring_size_ = 0;
+    io_uring_sqe *sqes_ = nullptr;
+    std::size_t sqes_size_ = 0;
+    unsigned *sq_tail_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr;
+    unsigned *cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe *cqes_ = nullptr;
+};
+} // namespace
+
+bool uring_available()
+{
+    // Setting up a ring costs several system calls and two mappings; the
+    // answer cannot change while the process runs. A ring alone is not
+    // enough: 5.4 and 5.5 kernels set one up but fail every write with
+    // EINVAL.
+    static const bool available = [] {
+        Ring ring;
+        return ring.ok() && ring.supports(IORING_OP_WRITE);
+    }();
+    return available;
+}
+
+bool uring_emit_blocks(int fd, const char *block, std::size_t block_lines, std::size_t line_size,
+                       std::uint64_t lines)
+{
+    // Writes carry explicit offsets so that several can be in flight at once
+    // and still land in order. That needs a regular file opened without
+    // O_APPEND, which would ignore the offsets.
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || (flags & O_APPEND))
+        return false;
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start < 0 || !uring_available())
+        return false;
+    Ring ring;
+    if (!ring.ok())
+        return false;
+
+    struct Write
+    {
+        std::uint64_t offset;
+        unsigned size;
+    };
+    Write writes[kQueueDepth];
+    unsigned free_slots[kQueueDepth];
+    unsigned free_count = std::min(ring.depth(), kQueueDepth);
+    for (unsigned i = 0; i < free_count; ++i)
+        free_slots[i] = i;
+    unsigned in_flight = 0;
+    std::uint64_t offset = static_cast<std::uint64_t>(start);
+    int error = 0;
+
+    // Each write is a run of whole lines. A slot is refilled as soon as its
+    // completion is reaped, so the kernel always has the next writes queued.
+    while (in_flight > 0 || (lines > 0 && error == 0))
+    {
+        unsigned queued = 0;
+        for (; free_count > 0 && lines > 0 && error == 0; ++queued)
+        {
+            unsigned slot = free_slots[--free_count];
+            std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(lines, block_lines));
+            writes[slot] = {offset, static_cast<unsigned>(n * line_size)};
+            ring.queue_write(fd, block, writes[slot].size, offset, slot);
+            offset += writes[slot].size;
+            lines -= n;
+        }
+        if (queued > 0)
+        {
+            ring.submit(queued);
+            in_flight += queued;
+        }
+
+        io_uring_cqe cqe = ring.wait_completion();
+        do
+        {
+            --in_flight;
+            const Write &done = writes[cqe.user_data];
+            free_slots[free_count++] = static_cast<unsigned>(cqe.user_data);
+            // Keep reaping after a failure: the kernel still reads from
+            // `block` until every write in flight has completed.
+            if (cqe.res < 0)
+            {
+                if (error == 0)
+                    error = -cqe.res;
+                continue;
+            }
+            // A short write leaves a gap; fill it synchronously.
+            for (std::size_t written = static_cast<std::size_t>(cqe.res); written < done.size && error == 0;)
+            {
+                ssize_t n = pwrite(fd, block + written, done.size - written,
+                                   static_cast<off_t>(done.offset + written));
+                if (n > 0)
+                    written += static_cast<std::size_t>(n);
+                else if (n == 0)
+                    error = EIO;
+                else if (errno != EINTR)
+                    error = errno;
+            }
+        } while (in_flight > 0 && ring.poll_completion(cqe));
+    }
+    if (error != 0)
+        throw std::system_error(error, std::generic_category(), "io_uring write");
+
+    // pwrite-style writes leave the file position alone; move it past the
+    // output as write() would have.
+    if (lseek(fd, static_cast<off_t>(offset), SEEK_SET) < 0)
+        throw std::system_error(errno, std::generic_category(), "lseek");
+    return true;
+}
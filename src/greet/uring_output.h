@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// io_uring write engine used by the IoUring output backend. Only built when
+// CMake finds <linux/io_uring.h> and GREET_WITH_IO_URING is ON, in which case
+// GREET_HAVE_IO_URING is defined.
+
+// True if the running kernel lets this process create an io_uring instance
+// with the features the engine needs. Probed once and cached.
+bool uring_available();
+
+// Write `lines` lines of `line_size` bytes to `fd`, taking them from `block`,
+// which holds `block_lines` pre-rendered lines, and leave the file position
+// after them. Up to 32 writes are kept in flight at explicit offsets. Returns
+// false without writing anything if `fd` is not a regular file opened without
+// O_APPEND or an io_uring cannot be set up, so the caller can fall back to
+// synchronous writes. Throws std::system_error if a write fails.
+bool uring_emit_blocks(int fd, const char *block, std::size_t block_lines, std::size_t line_size,
+                       std::uint64_t lines);
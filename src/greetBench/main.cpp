@@ -0,0 +1,711 @@
+// Microbenchmarks for the greet library. Every case reports the time per
+// call, and the heap allocations and allocated bytes per call, as counted by
+// the greet_alloc_track instrumentation. Batch cases count one call per
+// greeting. `--json` prints the results as a JSON array for regression
+// tracking.
+//
+// On Linux the timed loop is also measured with hardware counters through
+// perf_event_open(2): cycles, instructions, cache misses and branch misses,
+// reported as cycles per call, IPC and misses per call. Where perf events are
+// not permitted (perf_event_paranoid, containers, VMs without a PMU) those
+// columns read "-" and the timings are unaffected.
+//
+// The output/ cases write greetings into a pipe drained by another thread,
+// through iostreams and through each block backend of greet_world --backend.
+// The output/file/ cases write them into a temporary file instead, where the
+// io_uring backend (when built) runs next to the synchronous ones. A call is
+// one line, so ns/call compares their throughput directly.
+//
+// The stream/ and file/ cases greet a file of names into /dev/null: the
+// sequential --stdin path, then the parallel --stdin --threads N and
+// --input paths for N = 1, 2, 4, ... up to the core count. A call is one
+// name.
+//
+// Each case also reports the peak resident set size while it ran. On Linux
+// the kernel's high-water mark is reset before every case (clear_refs), so
+// the figure is that case's peak; elsewhere, or where the reset is refused,
+// it is getrusage's ru_maxrss, the peak of the whole process so far.
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <cstring>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "alloc_track.h"
+#include "block_output.h"
+#include "greet.h"
+#include "greet_stream.h"
+#include "greet_template.h"
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+// Keep the compiler from discarding a result it can see is unused.
+template <typename T>
+void do_not_optimize(const T &value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void *sink;
+    sink = &value;
+#endif
+}
+
+struct Options
+{
+    double min_time = 0.2; // seconds per case
+    std::string filter;
+    bool json = false;
+    std::size_t sites = 0; // allocation call sites to list after the results
+    bool counters = true;  // read hardware counters where permitted
+};
+
+// Hardware event totals over one measurement; a count is negative when its
+// event could not be opened.
+struct CounterValues
+{
+    enum Event
+    {
+        Cycles,
+        Instructions,
+        CacheMisses,
+        BranchMisses,
+        kEvents
+    };
+
+    std::array<double, kEvents> counts{-1, -1, -1, -1};
+
+    bool has(Event event) const { return counts[event] >= 0; }
+};
+
+// The calling thread's hardware counters, opened once as a single perf event
+// group so every event covers the same instructions. Events the CPU or kernel
+// does not offer are left out; if none opens, the group is unavailable and
+// why() says so. Counts are user space only, which perf_event_paranoid 2
+// (the common default) allows for a process's own threads. When the PMU is
+// shared, the kernel multiplexes the group and the counts are scaled up by
+// time enabled over time running.
+class HardwareCounters
+{
+public:
+    HardwareCounters()
+    {
+#ifdef __linux__
+        static constexpr std::uint64_t kConfigs[CounterValues::kEvents] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES};
+        for (int event = 0; event < CounterValues::kEvents; ++event)
+        {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = kConfigs[event];
+            attr.disabled = leader_ < 0 ? 1 : 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+            if (fd < 0)
+            {
+                if (why_.empty())
+                    why_ = std::string("perf_event_open: ") + std::strerror(errno);
+                continue;
+            }
+            if (leader_ < 0)
+                leader_ = fd;
+            fds_.push_back(fd);
+            events_.push_back(event);
+        }
+        if (leader_ >= 0)
+            why_.clear();
+#else
+        why_ = "hardware counters need Linux perf events";
+#endif
+    }
+
+    ~HardwareCounters()
+    {
+#ifdef __linux__
+        for (int fd : fds_)
+            ::close(fd);
+#endif
+    }
+
+    HardwareCounters(const HardwareCounters &) = delete;
+    HardwareCounters &operator=(const HardwareCounters &) = delete;
+
+    bool available() const { return leader_ >= 0; }
+    const std::string &why() const { return why_; }
+
+    void start()
+    {
+#ifdef __linux__
+        if (!available())
+            return;
+        ioctl(leader_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    CounterValues stop()
+    {
+        CounterValues values;
+#ifdef __linux__
+        if (!available())
+            return values;
+        ioctl(leader_, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+        // nr, time enabled, time running, then one value per event.
+        std::uint64_t data[3 + CounterValues::kEvents];
+        ssize_t n = ::read(leader_, data, sizeof(data));
+        if (n < static_cast<ssize_t>((3 + events_.size()) * sizeof(std::uint64_t)) || data[2] == 0)
+            return values;
+        double scale = double(data[1]) / double(data[2]);
+        for (std::size_t i = 0; i < events_.size() && i < data[0]; ++i)
+            values.counts[events_[i]] = double(data[3 + i]) * scale;
+#endif
+        return values;
+    }
+
+private:
+    int leader_ = -1;
+    std::vector<int> fds_;
+    std::vector<int> events_; // CounterValues::Event of each fd, in group order
+    std::string why_;
+};
+
+// Peak resident set size of the process, in KiB.
+class PeakRss
+{
+public:
+    // Start a new peak at the current resident set size. Returns false if the
+    // kernel keeps the old one, in which case peak_kib() covers the whole
+    // process lifetime.
+    static bool reset()
+    {
+#ifdef __linux__
+        std::FILE *file = std::fopen("/proc/self/clear_refs", "w");
+        if (file == nullptr)
+            return false;
+        bool ok = std::fputs("5", file) >= 0;
+        return std::fclose(file) == 0 && ok;
+#else
+        return false;
+#endif
+    }
+
+    // Negative if the platform does not say.
+    static double peak_kib()
+    {
+#ifdef __linux__
+        // VmHWM follows reset(); ru_maxrss can lag behind it.
+        if (std::FILE *file = std::fopen("/proc/self/status", "r"))
+        {
+            char line[256];
+            long kib = -1;
+            while (std::fgets(line, sizeof(line), file) != nullptr)
+            {
+                if (std::sscanf(line, "VmHWM: %ld kB", &kib) == 1)
+                    break;
+            }
+            std::fclose(file);
+            if (kib >= 0)
+                return double(kib);
+        }
+#endif
+#ifndef _WIN32
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return -1;
+#ifdef __APPLE__
+        return double(usage.ru_maxrss) / 1024; // bytes on macOS
+#else
+        return double(usage.ru_maxrss);
+#endif
+#else
+        return -1;
+#endif
+    }
+};
+
+struct Result
+{
+    std::string name;
+    std::uint64_t calls = 0;
+    double ns_per_call = 0;
+    double allocs_per_call = 0;
+    double bytes_per_call = 0;
+    double peak_rss_kib = -1;
+    CounterValues counters; // totals over all calls
+};
+
+class Suite
+{
+public:
+    explicit Suite(const Options &options) : options_(options)
+    {
+        if (!options_.counters)
+            return;
+        counters_ = std::make_unique<HardwareCounters>();
+        if (!counters_->available())
+            std::fprintf(stderr, "greet_bench: hardware counters unavailable (%s)\n", counters_->why().c_str());
+    }
+
+    // Time `body`, which performs `calls_per_run` calls, for at least the
+    // configured time. The run count is calibrated first, so the clock is
+    // only read around whole rounds. `body` is a template parameter so the
+    // call inlines into the timing loop.
+    template <typename Body>
+    void add(const std::string &name, std::size_t calls_per_run, Body body)
+    {
+        if (name.find(options_.filter) == std::string::npos)
+            return;
+
+        PeakRss::reset();
+        body(); // warm up caches and any lazily grown buffers
+        std::uint64_t runs = 1;
+        for (;;)
+        {
+            auto start = Clock::now();
+            for (std::uint64_t i = 0; i < runs; ++i)
+                body();
+            if (std::chrono::duration<double>(Clock::now() - start).count() >= options_.min_time / 10 ||
+                runs >= (std::uint64_t(1) << 40))
+                break;
+            runs *= 2;
+        }
+
+        // The counters also see the clock reads between rounds, which the
+        // calibration above keeps to a negligible share.
+        std::uint64_t total_runs = 0;
+        AllocationScope scope(AllocationScope::Threads::All);
+        if (counters_)
+            counters_->start();
+        auto start = Clock::now();
+        double elapsed = 0;
+        while (elapsed < options_.min_time)
+        {
+            for (std::uint64_t i = 0; i < runs; ++i)
+                body();
+            total_runs += runs;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        }
+        CounterValues counted = counters_ ? counters_->stop() : CounterValues();
+
+        Result result;
+        result.name = name;
+        result.calls = total_runs * calls_per_run;
+        result.ns_per_call = elapsed * 1e9 / result.calls;
+        AllocationStats allocated = scope.stats();
+        result.allocs_per_call = double(allocated.allocations) / result.calls;
+        result.bytes_per_call = double(allocated.bytes) / result.calls;
+        result.peak_rss_kib = PeakRss::peak_kib();
+        result.counters = counted;
+        results_.push_back(result);
+    }
+
+    void print() const
+    {
+        if (options_.json)
+        {
+            std::printf("[\n");
+            for (std::size_t i = 0; i < results_.size(); ++i)
+            {
+                const Result &r = results_[i];
+                std::printf("  {\"name\": \"%s\", \"calls\": %llu, \"ns_per_call\": %.3f, \"allocs_per_call\": %.3f, "
+                            "\"bytes_per_call\": %.3f, \"peak_rss_kib\": %s, \"cycles_per_call\": %s, \"ipc\": %s, "
+                            "\"cache_misses_per_call\": %s, \"branch_misses_per_call\": %s}%s\n",
+                            r.name.c_str(), static_cast<unsigned long long>(r.calls), r.ns_per_call,
+                            r.allocs_per_call, r.bytes_per_call, json_number(r.peak_rss_kib).c_str(),
+                            json_number(cycles_per_call(r)).c_str(),
+                            json_number(ipc(r)).c_str(),
+                            json_number(per_call(r, CounterValues::CacheMisses)).c_str(),
+                            json_number(per_call(r, CounterValues::BranchMisses)).c_str(),
+                            i + 1 < results_.size() ? "," : "");
+            }
+            std::printf("]\n");
+            return;
+        }
+        std::printf("%-32s %14s %12s %12s %12s %12s %12s %6s %12s %12s\n", "benchmark", "calls", "ns/call",
+                    "allocs/call", "bytes/call", "peak KiB", "cycles/call", "IPC", "cmiss/call", "brmiss/call");
+        for (const Result &r : results_)
+            std::printf("%-32s %14llu %12.2f %12.3f %12.1f %12s %12s %6s %12s %12s\n", r.name.c_str(),
+                        static_cast<unsigned long long>(r.calls), r.ns_per_call, r.allocs_per_call,
+                        r.bytes_per_call, column(r.peak_rss_kib, "%.0f").c_str(),
+                        column(cycles_per_call(r), "%.1f").c_str(),
+                        column(ipc(r), "%.2f").c_str(),
+                        column(per_call(r, CounterValues::CacheMisses), "%.4f").c_str(),
+                        column(per_call(r, CounterValues::BranchMisses), "%.4f").c_str());
+    }
+
+private:
+    // Derived counter figures are negative when their events were not counted.
+    static double per_call(const Result &r, CounterValues::Event event)
+    {
+        return r.counters.has(event) ? r.counters.counts[event] / r.calls : -1;
+    }
+
+    static double cycles_per_call(const Result &r) { return per_call(r, CounterValues::Cycles); }
+
+    static double ipc(const Result &r)
+    {
+        const CounterValues &c = r.counters;
+        if (!c.has(CounterValues::Cycles) || !c.has(CounterValues::Instructions) ||
+            c.counts[CounterValues::Cycles] == 0)
+            return -1;
+        return c.counts[CounterValues::Instructions] / c.counts[CounterValues::Cycles];
+    }
+
+    static std::string column(double value, const char *format)
+    {
+        if (value < 0)
+            return "-";
+        char text[32];
+        std::snprintf(text, sizeof(text), format, value);
+        return text;
+    }
+
+    static std::string json_number(double value) { return value < 0 ? "null" : column(value, "%.4f"); }
+
+    Options options_;
+    std::unique_ptr<HardwareCounters> counters_;
+    std::vector<Result> results_;
+};
+
+#ifndef _WIN32
+// The write end of a pipe whose contents a second thread throws away; on Linux
+// by splicing them to /dev/null, so draining costs as little as possible.
+class PipeSink
+{
+public:
+    PipeSink()
+    {
+        if (pipe(fds_) != 0)
+            throw std::system_error(errno, std::generic_category(), "pipe");
+        thread_ = std::thread([fd = fds_[0]] { drain(fd); });
+    }
+
+    ~PipeSink()
+    {
+        ::close(fds_[1]);
+        thread_.join();
+        ::close(fds_[0]);
+    }
+
+    PipeSink(const PipeSink &) = delete;
+    PipeSink &operator=(const PipeSink &) = delete;
+
+    int fd() const { return fds_[1]; }
+
+private:
+    static void drain(int fd)
+    {
+#ifdef __linux__
+        int null = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (null >= 0)
+        {
+            ssize_t n;
+            while ((n = splice(fd, nullptr, null, nullptr, 1 << 20, SPLICE_F_MOVE)) > 0 || (n < 0 && errno == EINTR))
+            {
+            }
+            ::close(null);
+            if (n == 0)
+                return;
+        }
+#endif
+        char buffer[64 * 1024];
+        ssize_t n;
+        while ((n = ::read(fd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR))
+        {
+        }
+    }
+
+    int fds_[2];
+    std::thread thread_;
+};
+#endif
+
+void print_usage(std::FILE *out)
+{
+    std::fprintf(out, "usage: greet_bench [--json] [--filter SUBSTRING] [--min-time SECONDS] [--sites N]\n"
+                      "                   [--no-counters]\n"
+                      "  --json          print results as a JSON array\n"
+                      "  --filter S      only run benchmarks whose name contains S\n"
+                      "  --min-time S    measure each benchmark for at least S seconds (default: 0.2)\n"
+                      "  --sites N       list the N busiest allocation call sites on stderr\n"
+                      "  --no-counters   do not read hardware counters (cycles, IPC, cache and branch\n"
+                      "                  misses per call)\n");
+}
+
+Options parse_args(int argc, char **argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_usage(stdout);
+            std::exit(0);
+        }
+        else if (arg == "--json")
+        {
+            opts.json = true;
+        }
+        else if (arg == "--no-counters")
+        {
+            opts.counters = false;
+        }
+        else if ((arg == "--filter" || arg == "--min-time" || arg == "--sites") && i + 1 < argc)
+        {
+            std::string value = argv[++i];
+            if (arg == "--filter")
+                opts.filter = value;
+            else if (arg == "--sites")
+                opts.sites = std::stoul(value);
+            else
+                opts.min_time = std::stod(value);
+        }
+        else
+        {
+            throw std::invalid_argument("unexpected argument \"" + arg + "\"");
+        }
+    }
+    return opts;
+}
+
+void register_benchmarks(Suite &suite)
+{
+    static const GreetTemplate tmpl(kGreetPattern);
+    static const std::string_view kName = "Ada";
+    // Too long for the small-string buffer, so a fresh std::string allocates.
+    static const std::string_view kLongName = "Augusta Ada King, Countess of Lovelace";
+
+    suite.add("greet_view", 1, [] {
+        std::string_view view = greet_view();
+        do_not_optimize(view);
+    });
+    suite.add("greet/string", 1, [] {
+        std::string s = greet();
+        do_not_optimize(s);
+    });
+    suite.add("greet/append_reused", 1, [] {
+        static std::string out;
+        out.clear();
+        greet(out);
+        do_not_optimize(out);
+    });
+    suite.add("greet/buffer", 1, [] {
+        char buffer[64];
+        std::size_t n = greet(buffer, sizeof(buffer));
+        do_not_optimize(buffer);
+        do_not_optimize(n);
+    });
+
+    for (std::string_view name : {kName, kLongName})
+    {
+        std::string suffix = name == kName ? "/short" : "/long";
+        suite.add("template/fresh_string" + suffix, 1, [name] {
+            std::string out;
+            tmpl.render(name, out);
+            do_not_optimize(out);
+        });
+        suite.add("template/append_reused" + suffix, 1, [name] {
+            static std::string out;
+            out.clear();
+            tmpl.render(name, out);
+            do_not_optimize(out);
+        });
+        suite.add("template/buffer" + suffix, 1, [name] {
+            char buffer[128];
+            std::size_t n = tmpl.render(name, buffer, sizeof(buffer));
+            do_not_optimize(buffer);
+            do_not_optimize(n);
+        });
+        suite.add("template/arena" + suffix, 1, [name] {
+            static std::array<std::byte, 64 * 1024> storage;
+            static std::pmr::monotonic_buffer_resource arena(storage.data(), storage.size(),
+                                                             std::pmr::null_memory_resource());
+            static std::size_t used = 0;
+            if (used > storage.size() - 256)
+            {
+                arena.release();
+                used = 0;
+            }
+            std::string_view view = tmpl.render(name, arena);
+            used += view.size();
+            do_not_optimize(view);
+        });
+    }
+
+    constexpr std::size_t kBatch = 1000;
+    static std::vector<std::string> owned;
+    static std::vector<std::string_view> names;
+    for (std::size_t i = 0; i < kBatch; ++i)
+        owned.push_back("name-" + std::to_string(i));
+    names.assign(owned.begin(), owned.end());
+    suite.add("batch/1000_reused", kBatch, [] {
+        static GreetBatch batch;
+        greet_batch(names.data(), names.size(), batch, tmpl);
+        do_not_optimize(batch.data);
+    });
+    suite.add("batch/1000_fresh", kBatch, [] {
+        GreetBatch batch;
+        greet_batch(names.data(), names.size(), batch, tmpl);
+        do_not_optimize(batch.data);
+    });
+    suite.add("batch/1000_arena", kBatch, [] {
+        static std::array<std::byte, 64 * 1024> storage;
+        std::pmr::monotonic_buffer_resource arena(storage.data(), storage.size(), std::pmr::null_memory_resource());
+        GreetBatch batch(&arena);
+        greet_batch(names.data(), names.size(), batch, tmpl);
+        do_not_optimize(batch.data);
+    });
+
+#ifndef _WIN32
+    constexpr std::size_t kLines = 64 * 1024;
+    static const std::string line = std::string(greet_view()) + "\n";
+    PipeSink sink;
+    std::ofstream stream("/dev/fd/" + std::to_string(sink.fd()), std::ios::binary);
+    if (stream)
+        suite.add("output/iostream", kLines, [&stream] {
+            for (std::size_t i = 0; i < kLines; ++i)
+                stream << line;
+            stream.flush();
+        });
+    for (OutputBackend backend : {OutputBackend::Write, OutputBackend::Writev, OutputBackend::Vmsplice})
+    {
+        OutputBackend resolved = resolve_output_backend(sink.fd(), backend);
+        if (resolved != backend)
+            continue;
+        suite.add(std::string("output/") + to_string(backend), kLines,
+                  [&sink, resolved] { emit_repeated(sink.fd(), line, kLines, resolved); });
+    }
+
+    // Every run rewrites the start of the file, so it stays in the page cache.
+    char out_path[] = "/tmp/greet_bench-out-XXXXXX";
+    int out = mkstemp(out_path);
+    if (out >= 0)
+    {
+        unlink(out_path);
+        std::vector<OutputBackend> backends{OutputBackend::Write, OutputBackend::Writev};
+#ifdef GREET_HAVE_IO_URING
+        backends.push_back(OutputBackend::IoUring);
+#endif
+        for (OutputBackend backend : backends)
+        {
+            OutputBackend resolved = resolve_output_backend(out, backend);
+            if (resolved != backend)
+                continue;
+            suite.add(std::string("output/file/") + to_string(backend), kLines, [out, resolved] {
+                if (lseek(out, 0, SEEK_SET) != 0)
+                    throw std::system_error(errno, std::generic_category(), "lseek");
+                emit_repeated(out, line, kLines, resolved);
+            });
+        }
+        ::close(out);
+    }
+
+    constexpr std::size_t kNames = 256 * 1024;
+    char path[] = "/tmp/greet_bench-XXXXXX";
+    int in = mkstemp(path);
+    int null = ::open("/dev/null", O_WRONLY);
+    if (in >= 0 && null >= 0)
+    {
+        std::string input;
+        for (std::size_t i = 0; i < kNames; ++i)
+            input += "name-" + std::to_string(i) + "\n";
+        write_all(in, input.data(), input.size());
+        auto from_start = [in] {
+            if (lseek(in, 0, SEEK_SET) != 0)
+                throw std::system_error(errno, std::generic_category(), "lseek");
+        };
+
+        suite.add("stream/sequential", kNames, [in, null, from_start] {
+            from_start();
+            greet_stream(in, null, tmpl, FlushPolicy::Block);
+        });
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned threads = 1;; threads = std::min(2 * threads, cores))
+        {
+            suite.add("stream/parallel/" + std::to_string(threads), kNames, [in, null, from_start, threads] {
+                from_start();
+                greet_stream_parallel(in, null, tmpl, threads);
+            });
+            suite.add("file/parallel/" + std::to_string(threads), kNames,
+                      [&path, null, threads] { greet_file_parallel(path, null, tmpl, threads); });
+            if (threads == cores)
+                break;
+        }
+    }
+    if (in >= 0)
+    {
+        ::close(in);
+        unlink(path);
+    }
+    if (null >= 0)
+        ::close(null);
+#endif
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    try
+    {
+        opts = parse_args(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "greet_bench: %s\n", e.what());
+        print_usage(stderr);
+        return 2;
+    }
+
+    track_allocation_sites(opts.sites > 0);
+    Suite suite(opts);
+    register_benchmarks(suite);
+    track_allocation_sites(false);
+    suite.print();
+    std::fflush(stdout);
+
+    AllocationStats totals = allocation_totals();
+    std::fprintf(stderr, "greet_bench: %llu allocations, %llu bytes in total\n",
+                 static_cast<unsigned long long>(totals.allocations), static_cast<unsigned long long>(totals.bytes));
+    for (const AllocationSite &site : top_allocation_sites(opts.sites))
+        std::fprintf(stderr, "  %12llu allocations %14llu bytes  %s\n",
+                     static_cast<unsigned long long>(site.allocations), static_cast<unsigned long long>(site.bytes),
+                     site.where.c_str());
+    return 0;
+}
@@ -0,0 +1,296 @@
+// Thin client for a long-running `greet_world --serve` daemon. A launch costs
+// one connect and one round trip on a Unix socket instead of a full program
+// start. When no daemon is listening, the client starts one in the background
+// for later launches and renders this greeting itself, so no call ever waits
+// for the daemon to come up.
+//
+// The daemon inherits an flock() on "SOCKET.lock" and holds it for its whole
+// life. A client only spawns a daemon when it can take that lock, so
+// concurrent clients never start two daemons on one socket path.
+//
+// The default socket lives in $XDG_RUNTIME_DIR, or else in a directory under
+// /tmp that only the user can enter, so other local users can neither answer
+// in the daemon's place nor hold its lock. A daemon that does not answer
+// within kDaemonTimeout is treated like a missing one.
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "greet.h"
+#include "greet_template.h"
+#include "output.h"
+
+extern char **environ;
+
+namespace
+{
+constexpr int kStdout = 1;
+constexpr int kStderr = 2;
+// Longest wait for each send to or receive from the daemon.
+constexpr timeval kDaemonTimeout{0, 500 * 1000};
+
+struct Options
+{
+    std::string name; // empty: the default greeting
+    std::string socket_path;
+    std::string daemon_path;
+    bool spawn = true;
+};
+
+void print_error(std::string_view message) noexcept
+{
+    try
+    {
+        std::string line = "greet_client: ";
+        line += message;
+        line += '\n';
+        write_all(kStderr, line.data(), line.size());
+    }
+    catch (const std::exception &)
+    {
+    }
+}
+
+void print_usage(int fd)
+{
+    std::string_view usage =
+        "usage: greet_client [--socket PATH] [--daemon PROGRAM] [--no-spawn] [NAME]\n"
+        "  --socket PATH     daemon socket (default: $GREET_SOCKET, else greet_world.sock in\n"
+        "                    $XDG_RUNTIME_DIR or in a private /tmp/greet_world-UID directory)\n"
+        "  --daemon PROGRAM  greet_world to start when no daemon is running\n"
+        "                    (default: $GREET_WORLD or greet_world next to greet_client)\n"
+        "  --no-spawn        never start a daemon; greet locally when none is running\n";
+    write_all(fd, usage.data(), usage.size());
+}
+
+// Whether `path` is a real directory (not a symlink) owned by this user that
+// nobody else can write to or enter.
+bool private_directory(const std::string &path)
+{
+    struct stat st;
+    return ::lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode) && st.st_uid == getuid() &&
+           (st.st_mode & 077) == 0;
+}
+
+// Throws std::runtime_error when no safe default exists.
+std::string default_socket_path()
+{
+    if (const char *env = std::getenv("GREET_SOCKET"))
+        return env;
+    const char *runtime = std::getenv("XDG_RUNTIME_DIR");
+    if (runtime != nullptr && runtime[0] == '/' && private_directory(runtime))
+        return std::string(runtime) + "/greet_world.sock";
+
+    // /tmp is shared: create the directory 0700 ourselves, or accept an
+    // existing one only if it is ours and private.
+    std::string dir = "/tmp/greet_world-" + std::to_string(getuid());
+    if (::mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+        throw std::system_error(errno, std::generic_category(), dir);
+    if (!private_directory(dir))
+        throw std::runtime_error(dir + " is not a private directory owned by this user");
+    return dir + "/greet_world.sock";
+}
+
+std::string default_daemon_path()
+{
+    if (const char *env = std::getenv("GREET_WORLD"))
+        return env;
+    char self[4096];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0)
+        return "greet_world";
+    std::string path(self, static_cast<std::size_t>(n));
+    return path.substr(0, path.rfind('/') + 1) + "greet_world";
+}
+
+Options parse_args(int argc, char **argv)
+{
+    Options opts;
+    bool have_name = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_usage(kStdout);
+            std::exit(0);
+        }
+        else if (arg == "--no-spawn")
+        {
+            opts.spawn = false;
+        }
+        else if (arg == "--socket" || arg == "--daemon")
+        {
+            if (i + 1 >= argc)
+                throw std::invalid_argument(std::string(arg) + ": missing value");
+            (arg == "--socket" ? opts.socket_path : opts.daemon_path) = argv[++i];
+        }
+        else if (arg.rfind("--", 0) == 0 || have_name)
+        {
+            throw std::invalid_argument("unexpected argument \"" + std::string(arg) + "\"");
+        }
+        else
+        {
+            opts.name = std::string(arg);
+            have_name = true;
+        }
+    }
+    if (opts.name.find('\n') != std::string::npos)
+        throw std::invalid_argument("a name cannot contain a newline");
+    return opts;
+}
+
+// Ask the daemon at `path` for a greeting. Returns false when no daemon is
+// listening there or it does not answer in time.
+bool ask_daemon(const std::string &path, const std::string &name, std::string &response)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("socket path \"" + path + "\" is too long");
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "socket");
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &kDaemonTimeout, sizeof(kDaemonTimeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &kDaemonTimeout, sizeof(kDaemonTimeout));
+    if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    std::string request = name + "\n";
+    char buffer[4096];
+    try
+    {
+        write_all(fd, request.data(), request.size());
+        while (response.empty() || response.back() != '\n')
+        {
+            ssize_t n = ::read(fd, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+            {
+                ::close(fd);
+                response.clear();
+                return false; // the daemon went away or timed out mid-request
+            }
+            response.append(buffer, static_cast<std::size_t>(n));
+        }
+    }
+    catch (const std::system_error &)
+    {
+        ::close(fd);
+        response.clear();
+        return false;
+    }
+    ::close(fd);
+    return true;
+}
+
+// Start `greet_world --serve path` in its own session unless another client
+// already has. The daemon inherits the lock and keeps it until it exits.
+void spawn_daemon(const Options &opts)
+{
+    std::string lock_path = opts.socket_path + ".lock";
+    int lock = ::open(lock_path.c_str(), O_RDWR | O_CREAT | O_NOFOLLOW, 0600);
+    if (lock < 0)
+        return;
+    struct stat st;
+    if (::fstat(lock, &st) != 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid())
+    {
+        ::close(lock); // someone else's file: never start a daemon on it
+        return;
+    }
+    if (flock(lock, LOCK_EX | LOCK_NB) != 0)
+    {
+        ::close(lock); // a daemon is running or being started
+        return;
+    }
+
+    std::string program = opts.daemon_path.empty() ? default_daemon_path() : opts.daemon_path;
+    char serve[] = "--serve";
+    char *argv[] = {const_cast<char *>(program.c_str()), serve, const_cast<char *>(opts.socket_path.c_str()),
+                    nullptr};
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 2, "/dev/null", O_WRONLY, 0);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+    pid_t pid;
+    int err = posix_spawn(&pid, program.c_str(), &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(lock);
+    if (err != 0)
+        print_error("cannot start " + program + ": " + std::strerror(err));
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    try
+    {
+        opts = parse_args(argc, argv);
+    }
+    catch (const std::invalid_argument &e)
+    {
+        print_error(e.what());
+        print_usage(kStderr);
+        return 2;
+    }
+
+    try
+    {
+        std::string response;
+        if (opts.socket_path.empty())
+        {
+            try
+            {
+                opts.socket_path = default_socket_path();
+            }
+            catch (const std::exception &e)
+            {
+                print_error(std::string(e.what()) + "; greeting without a daemon");
+            }
+        }
+        if (opts.socket_path.empty() || !ask_daemon(opts.socket_path, opts.name, response))
+        {
+            if (opts.spawn && !opts.socket_path.empty())
+                spawn_daemon(opts);
+            if (opts.name.empty())
+                response.append(greet_view());
+            else
+                GreetTemplate(kGreetPattern).render(opts.name, response);
+            response += '\n';
+        }
+        write_all(kStdout, response.data(), response.size());
+    }
+    catch (const std::exception &e)
+    {
+        print_error(e.what());
+        return 1;
+    }
+    return 0;
+}
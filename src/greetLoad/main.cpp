@@ -0,0 +1,501 @@
+// Closed-loop load generator for `greet_world --serve`, `--http`, `--shm` and
+// `--udp`. Opens many connections from one epoll loop; each keeps a fixed
+// number of requests in flight and sends the next batch as soon as the
+// previous one is answered. The shared-memory channel takes a single client,
+// which sends one request at a time. UDP uses one socket per thread and moves
+// each batch of datagrams with one sendmmsg() and as few recvmmsg() calls as
+// it takes to collect the answers.
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "shm_channel.h"
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string socket_path;
+    int http_port = 0;    // when set, speak HTTP to 127.0.0.1 instead
+    std::string shm_name; // when set, use the shared-memory channel instead
+    int udp_port = 0;     // when set, send datagrams to 127.0.0.1 instead
+    unsigned spins = 1000;
+    unsigned connections = 64;
+    unsigned pipeline = 1;
+    unsigned threads = 1;
+    double duration = 5.0;
+    std::string name; // empty: ask for the default greeting
+};
+
+struct LoadResult
+{
+    std::uint64_t requests = 0;
+    std::uint64_t lost = 0; // datagrams that got no answer in time
+    std::vector<std::uint32_t> latencies; // per request batch, in nanoseconds
+};
+
+struct Connection
+{
+    int fd = -1;
+    unsigned outstanding = 0;
+    Clock::time_point sent;
+    std::string tail; // end of the last read, in case a terminator straddles reads
+};
+
+void print_usage(std::ostream &os)
+{
+    os << "usage: greet_load (SOCKET | --http PORT | --shm NAME | --udp PORT) [--connections N] [--pipeline N]\n"
+          "                  [--threads N] [--duration SECONDS] [--name NAME] [--spin N]\n"
+          "  --http PORT      send HTTP GET /greet requests to 127.0.0.1:PORT\n"
+          "  --shm NAME       send requests over the shared-memory channel NAME (one client)\n"
+          "  --spin N         polls before a --shm wait sleeps on a futex (default: 1000)\n"
+          "  --udp PORT       send greeting datagrams to 127.0.0.1:PORT, --pipeline per batch\n"
+          "  --connections N  concurrent connections (default: 64)\n"
+          "  --pipeline N     requests in flight per connection (default: 1)\n"
+          "  --threads N      spread the connections over N client threads (default: 1)\n"
+          "  --duration S     how long to run (default: 5)\n"
+          "  --name NAME      name to request a greeting for (default: the plain greeting)\n";
+}
+
+Options parse_args(int argc, char **argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_usage(std::cout);
+            std::exit(0);
+        }
+        if (arg.rfind("--", 0) != 0)
+        {
+            opts.socket_path = arg;
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw std::invalid_argument(arg + ": missing value");
+        std::string value = argv[++i];
+        if (arg == "--connections")
+            opts.connections = static_cast<unsigned>(std::stoul(value));
+        else if (arg == "--threads")
+            opts.threads = static_cast<unsigned>(std::stoul(value));
+        else if (arg == "--pipeline")
+            opts.pipeline = static_cast<unsigned>(std::stoul(value));
+        else if (arg == "--duration")
+            opts.duration = std::stod(value);
+        else if (arg == "--name")
+            opts.name = value;
+        else if (arg == "--http")
+            opts.http_port = std::stoi(value);
+        else if (arg == "--shm")
+            opts.shm_name = value;
+        else if (arg == "--udp")
+            opts.udp_port = std::stoi(value);
+        else if (arg == "--spin")
+            opts.spins = static_cast<unsigned>(std::stoul(value));
+        else
+            throw std::invalid_argument("unknown option \"" + arg + "\"");
+    }
+    if ((opts.socket_path.empty() && opts.http_port == 0 && opts.shm_name.empty() && opts.udp_port == 0) ||
+        opts.connections == 0 || opts.pipeline == 0 || opts.threads == 0)
+        throw std::invalid_argument("a socket path, --http, --shm or --udp target, and non-zero counts are required");
+    return opts;
+}
+
+int connect_unix(const std::string &path)
+{
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::invalid_argument("socket path too long");
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        throw std::system_error(errno, std::generic_category(), "connect " + path);
+    return fd;
+}
+
+int connect_localhost(int port)
+{
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<std::uint16_t>(port));
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        throw std::system_error(errno, std::generic_category(), "connect 127.0.0.1:" + std::to_string(port));
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+std::string url_encode(const std::string &value)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    std::string out;
+    for (unsigned char c : value)
+    {
+        if (std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~')
+        {
+            out += static_cast<char>(c);
+        }
+        else
+        {
+            out += '%';
+            out += hex[c >> 4];
+            out += hex[c & 15];
+        }
+    }
+    return out;
+}
+
+// Count the responses completed by `data`, each ending in `terminator`.
+unsigned count_responses(Connection &c, const char *data, std::size_t size, const std::string &terminator)
+{
+    if (terminator.size() == 1)
+        return static_cast<unsigned>(std::count(data, data + size, terminator[0]));
+    c.tail.append(data, size);
+    unsigned count = 0;
+    std::size_t pos = 0;
+    while ((pos = c.tail.find(terminator, pos)) != std::string::npos)
+    {
+        ++count;
+        pos += terminator.size();
+    }
+    c.tail.erase(0, c.tail.size() < terminator.size() ? 0 : c.tail.size() - (terminator.size() - 1));
+    return count;
+}
+
+void send_all(int fd, const std::string &data)
+{
+    std::size_t done = 0;
+    while (done < data.size())
+    {
+        ssize_t n = ::send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "send");
+        }
+        done += static_cast<std::size_t>(n);
+    }
+}
+
+double percentile(const std::vector<std::uint32_t> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    std::size_t index = static_cast<std::size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[index] / 1000.0;
+}
+// Send one request at a time over the shared-memory channel until the deadline.
+LoadResult run_shm(const Options &opts, Clock::time_point deadline)
+{
+    LoadResult result;
+    result.latencies.reserve(1 << 20);
+    ShmChannel channel = ShmChannel::open(opts.shm_name);
+    channel.set_spin(opts.spins);
+    std::string response;
+    for (auto now = Clock::now(); now < deadline;)
+    {
+        auto sent = now;
+        channel.send_request(opts.name);
+        channel.receive_response(response);
+        now = Clock::now();
+        result.latencies.push_back(static_cast<std::uint32_t>(std::min<std::int64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent).count(), UINT32_MAX)));
+        ++result.requests;
+    }
+    return result;
+}
+
+// Send `pipeline` datagrams at a time to the UDP service and wait for their
+// answers until the deadline. A batch whose answers stop arriving for 200 ms
+// counts the missing ones as lost and moves on.
+LoadResult run_udp(const Options &opts, Clock::time_point deadline)
+{
+    LoadResult result;
+    result.latencies.reserve(1 << 20);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(static_cast<std::uint16_t>(opts.udp_port));
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0)
+        throw std::system_error(errno, std::generic_category(), "connect 127.0.0.1:" + std::to_string(opts.udp_port));
+    timeval timeout{0, 200 * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    unsigned batch = opts.pipeline;
+    constexpr std::size_t kDatagramSize = 2048;
+    std::vector<char> in_buffers(batch * kDatagramSize);
+    std::vector<iovec> out_iov(batch), in_iov(batch);
+    std::vector<mmsghdr> out_msgs(batch), in_msgs(batch);
+    for (unsigned i = 0; i < batch; ++i)
+    {
+        out_iov[i] = {const_cast<char *>(opts.name.data()), opts.name.size()};
+        in_iov[i] = {in_buffers.data() + i * kDatagramSize, kDatagramSize};
+        std::memset(&out_msgs[i], 0, sizeof(mmsghdr));
+        out_msgs[i].msg_hdr.msg_iov = &out_iov[i];
+        out_msgs[i].msg_hdr.msg_iovlen = 1;
+        std::memset(&in_msgs[i], 0, sizeof(mmsghdr));
+        in_msgs[i].msg_hdr.msg_iov = &in_iov[i];
+        in_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    for (auto now = Clock::now(); now < deadline;)
+    {
+        auto sent = now;
+        unsigned queued = 0;
+        while (queued < batch)
+        {
+            int n = sendmmsg(fd, out_msgs.data() + queued, batch - queued, 0);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                ::close(fd);
+                throw std::system_error(errno, std::generic_category(), "sendmmsg");
+            }
+            queued += static_cast<unsigned>(n);
+        }
+        unsigned answered = 0;
+        while (answered < batch)
+        {
+            int n = recvmmsg(fd, in_msgs.data(), batch - answered, MSG_WAITFORONE, nullptr);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED)
+                    break;
+                ::close(fd);
+                throw std::system_error(errno, std::generic_category(), "recvmmsg");
+            }
+            answered += static_cast<unsigned>(n);
+        }
+        now = Clock::now();
+        result.lost += batch - answered;
+        result.requests += answered;
+        result.latencies.push_back(static_cast<std::uint32_t>(std::min<std::int64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - sent).count(), UINT32_MAX)));
+    }
+    ::close(fd);
+    return result;
+}
+
+// Drive `count` connections until the deadline; safe to run on several
+// threads at once.
+LoadResult run_connections(const Options &opts, unsigned count, const std::string &request,
+                           const std::string &terminator, Clock::time_point deadline)
+{
+    LoadResult result;
+    int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0)
+        throw std::system_error(errno, std::generic_category(), "epoll_create1");
+    std::vector<Connection> connections(count);
+    for (std::size_t i = 0; i < connections.size(); ++i)
+    {
+        connections[i].fd = opts.http_port ? connect_localhost(opts.http_port) : connect_unix(opts.socket_path);
+        epoll_event ev;
+        std::memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, connections[i].fd, &ev);
+    }
+
+    result.latencies.reserve(1 << 20);
+    for (Connection &c : connections)
+    {
+        c.sent = Clock::now();
+        c.outstanding = opts.pipeline;
+        send_all(c.fd, request);
+    }
+
+    std::vector<epoll_event> events(256);
+    char buffer[64 * 1024];
+    unsigned busy = count;
+    while (busy > 0)
+    {
+        int n = epoll_wait(epoll, events.data(), static_cast<int>(events.size()), 1000);
+        if (n < 0 && errno != EINTR)
+            throw std::system_error(errno, std::generic_category(), "epoll_wait");
+        for (int i = 0; i < n; ++i)
+        {
+            Connection &c = connections[events[i].data.u64];
+            ssize_t got = ::recv(c.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (got <= 0)
+            {
+                if (got < 0 && (errno == EAGAIN || errno == EINTR))
+                    continue;
+                throw std::runtime_error("server closed a connection");
+            }
+            c.outstanding -= count_responses(c, buffer, static_cast<std::size_t>(got), terminator);
+            if (c.outstanding > 0)
+                continue;
+
+            auto now = Clock::now();
+            result.latencies.push_back(static_cast<std::uint32_t>(
+                std::min<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(now - c.sent).count(),
+                                       UINT32_MAX)));
+            result.requests += opts.pipeline;
+            if (now >= deadline)
+            {
+                --busy;
+                continue;
+            }
+            c.sent = now;
+            c.outstanding = opts.pipeline;
+            send_all(c.fd, request);
+        }
+    }
+
+    for (Connection &c : connections)
+        ::close(c.fd);
+    ::close(epoll);
+    return result;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    try
+    {
+        opts = parse_args(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "greet_load: " << e.what() << "\n";
+        print_usage(std::cerr);
+        return 2;
+    }
+
+    try
+    {
+        rlimit limit;
+        if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+        {
+            limit.rlim_cur = limit.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+
+        // HTTP responses carry no blank line in their body, so the end of each
+        // response head is enough to count them.
+        std::string request;
+        std::string terminator = "\n";
+        for (unsigned i = 0; i < opts.pipeline; ++i)
+        {
+            if (opts.http_port == 0)
+            {
+                request += opts.name + "\n";
+                continue;
+            }
+            request += "GET /greet";
+            if (!opts.name.empty())
+                request += "?name=" + url_encode(opts.name);
+            request += " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+            terminator = "\r\n\r\n";
+        }
+
+        auto start = Clock::now();
+        auto deadline =
+            start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(opts.duration));
+        if (!opts.shm_name.empty())
+        {
+            opts.connections = 1;
+            opts.threads = 1;
+            opts.pipeline = 1;
+        }
+        if (opts.udp_port != 0)
+            opts.connections = opts.threads;
+        unsigned threads = std::min(opts.threads, opts.connections);
+        std::vector<LoadResult> results(threads);
+        std::vector<std::exception_ptr> errors(threads);
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < threads; ++t)
+        {
+            unsigned count = opts.connections / threads + (t < opts.connections % threads ? 1 : 0);
+            workers.emplace_back([&, t, count] {
+                try
+                {
+                    if (!opts.shm_name.empty())
+                        results[t] = run_shm(opts, deadline);
+                    else if (opts.udp_port != 0)
+                        results[t] = run_udp(opts, deadline);
+                    else
+                        results[t] = run_connections(opts, count, request, terminator, deadline);
+                }
+                catch (...)
+                {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        for (std::thread &worker : workers)
+            worker.join();
+        for (std::exception_ptr &error : errors)
+        {
+            if (error)
+                std::rethrow_exception(error);
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+        std::uint64_t requests = 0;
+        std::uint64_t lost = 0;
+        std::vector<std::uint32_t> latencies;
+        for (LoadResult &result : results)
+        {
+            requests += result.requests;
+            lost += result.lost;
+            latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        std::cout << "connections=" << opts.connections << " threads=" << threads << " pipeline=" << opts.pipeline
+                  << " requests=" << requests << " seconds=" << seconds << " rps=" << requests / seconds;
+        if (opts.udp_port != 0)
+            std::cout << " lost=" << lost;
+        std::cout << "\n"
+                  << "latency_us p50=" << percentile(latencies, 50) << " p90=" << percentile(latencies, 90)
+                  << " p99=" << percentile(latencies, 99) << " p99.9=" << percentile(latencies, 99.9)
+                  << " max=" << percentile(latencies, 100) << "\n";
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "greet_load: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,271 @@
+// Process-spawn benchmark for the short-lived programs. Launches each program
+// many times, first one at a time and then with several launches in flight,
+// and reports percentiles of the wall time per launch (spawn to reap), the
+// child's user and system CPU time and its peak resident set size, as
+// reported by wait4(). Output goes to /dev/null. The RSS figure includes the
+// few pages the forked child holds before it execs. Linux only.
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+    unsigned runs = 1000;
+    unsigned concurrency = std::max(2u, std::thread::hardware_concurrency());
+    bool json = false;
+    std::vector<std::string> programs;
+};
+
+// One finished launch.
+struct Sample
+{
+    double wall_us;
+    double user_us;
+    double sys_us;
+    double max_rss_kb;
+};
+
+struct Report
+{
+    std::string program;
+    unsigned concurrency;
+    unsigned runs;
+    double launches_per_second;
+    std::vector<Sample> samples;
+};
+
+void print_usage(std::FILE *out)
+{
+    std::fprintf(out, "usage: greet_startup [--runs N] [--concurrency N] [--json] [PROGRAM...]\n"
+                      "  --runs N         launches per program and mode (default: 1000)\n"
+                      "  --concurrency N  launches in flight for the concurrent mode (default: max(2, cores))\n"
+                      "  --json           print results as a JSON array\n"
+                      "Each PROGRAM runs without arguments, one at a time and then concurrently. Without\n"
+                      "programs, hello_world and greet_world next to greet_startup are measured.\n");
+}
+
+std::string sibling(const std::string &name)
+{
+    char self[4096];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0)
+        return name;
+    std::string path(self, static_cast<std::size_t>(n));
+    return path.substr(0, path.rfind('/') + 1) + name;
+}
+
+Options parse_args(int argc, char **argv)
+{
+    Options opts;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--help" || arg == "-h")
+        {
+            print_usage(stdout);
+            std::exit(0);
+        }
+        else if (arg == "--json")
+        {
+            opts.json = true;
+        }
+        else if (arg == "--runs" || arg == "--concurrency")
+        {
+            if (i + 1 >= argc)
+                throw std::invalid_argument(arg + ": missing value");
+            unsigned value = static_cast<unsigned>(std::stoul(argv[++i]));
+            (arg == "--runs" ? opts.runs : opts.concurrency) = value;
+        }
+        else if (arg.rfind("--", 0) == 0)
+        {
+            throw std::invalid_argument("unknown option \"" + arg + "\"");
+        }
+        else
+        {
+            opts.programs.push_back(arg);
+        }
+    }
+    if (opts.runs == 0 || opts.concurrency == 0)
+        throw std::invalid_argument("--runs and --concurrency must be non-zero");
+    if (opts.programs.empty())
+        opts.programs = {sibling("hello_world"), sibling("greet_world")};
+    return opts;
+}
+
+double micros(const timeval &tv)
+{
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+// Launch `program` `runs` times with up to `concurrency` children alive at
+// once. Every child is reaped with wait4() to collect its resource usage.
+// Children are started with fork() rather than posix_spawn(): a vfork-style
+// spawn shares the harness's address space until exec, and the kernel would
+// then report the harness's peak RSS as the child's.
+Report measure(const std::string &program, unsigned runs, unsigned concurrency)
+{
+    Report report{program, concurrency, runs, 0, {}};
+    report.samples.reserve(runs);
+    char *argv[] = {const_cast<char *>(program.c_str()), nullptr};
+    std::unordered_map<pid_t, Clock::time_point> running;
+    unsigned started = 0;
+    std::string failure;
+    auto begin = Clock::now();
+    while (report.samples.size() < runs && failure.empty())
+    {
+        while (started < runs && running.size() < concurrency)
+        {
+            auto start = Clock::now();
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                int null = ::open("/dev/null", O_WRONLY);
+                dup2(null, 1);
+                execv(program.c_str(), argv);
+                _exit(127);
+            }
+            if (pid < 0)
+            {
+                int err = errno;
+                // Reap what is still running before giving up.
+                for (auto &child : running)
+                    waitpid(child.first, nullptr, 0);
+                throw std::system_error(err, std::generic_category(), "fork");
+            }
+            running.emplace(pid, start);
+            ++started;
+        }
+
+        int status;
+        rusage usage;
+        pid_t pid = wait4(-1, &status, 0, &usage);
+        if (pid < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "wait4");
+        }
+        auto now = Clock::now();
+        auto it = running.find(pid);
+        if (it == running.end())
+            continue;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failure = program + " did not exit successfully";
+        report.samples.push_back({std::chrono::duration<double, std::micro>(now - it->second).count(),
+                                  micros(usage.ru_utime), micros(usage.ru_stime),
+                                  static_cast<double>(usage.ru_maxrss)});
+        running.erase(it);
+    }
+    for (auto &child : running)
+        waitpid(child.first, nullptr, 0);
+    if (!failure.empty())
+        throw std::runtime_error(failure);
+    report.launches_per_second = runs / std::chrono::duration<double>(Clock::now() - begin).count();
+    return report;
+}
+
+// Percentile `p` of one field of the samples.
+double percentile(const std::vector<Sample> &samples, double Sample::*field, double p)
+{
+    std::vector<double> values;
+    values.reserve(samples.size());
+    for (const Sample &s : samples)
+        values.push_back(s.*field);
+    std::sort(values.begin(), values.end());
+    return values[static_cast<std::size_t>(p / 100.0 * (values.size() - 1) + 0.5)];
+}
+
+void print(const std::vector<Report> &reports, bool json)
+{
+    static const std::pair<const char *, double Sample::*> fields[] = {{"wall_us", &Sample::wall_us},
+                                                                       {"user_us", &Sample::user_us},
+                                                                       {"sys_us", &Sample::sys_us},
+                                                                       {"max_rss_kb", &Sample::max_rss_kb}};
+    static const double points[] = {50, 90, 99, 100};
+    if (json)
+        std::printf("[\n");
+    for (std::size_t r = 0; r < reports.size(); ++r)
+    {
+        const Report &report = reports[r];
+        if (json)
+        {
+            std::printf("  {\"program\": \"%s\", \"concurrency\": %u, \"runs\": %u, \"launches_per_second\": %.1f",
+                        report.program.c_str(), report.concurrency, report.runs, report.launches_per_second);
+            for (const auto &field : fields)
+                std::printf(", \"%s\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f}", field.first,
+                            percentile(report.samples, field.second, 50), percentile(report.samples, field.second, 90),
+                            percentile(report.samples, field.second, 99),
+                            percentile(report.samples, field.second, 100));
+            std::printf("}%s\n", r + 1 < reports.size() ? "," : "");
+            continue;
+        }
+        std::printf("%s concurrency=%u runs=%u launches/s=%.0f\n", report.program.c_str(), report.concurrency,
+                    report.runs, report.launches_per_second);
+        for (const auto &field : fields)
+        {
+            std::printf("  %-11s", field.first);
+            for (double p : points)
+                std::printf(" %s=%.0f", p == 100 ? "max" : p == 50 ? "p50" : p == 90 ? "p90" : "p99",
+                            percentile(report.samples, field.second, p));
+            std::printf("\n");
+        }
+    }
+    if (json)
+        std::printf("]\n");
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opts;
+    try
+    {
+        opts = parse_args(argc, argv);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "greet_startup: %s\n", e.what());
+        print_usage(stderr);
+        return 2;
+    }
+
+    try
+    {
+        std::vector<Report> reports;
+        for (const std::string &program : opts.programs)
+        {
+            measure(program, 1, 1); // warm the page cache
+            reports.push_back(measure(program, opts.runs, 1));
+            if (opts.concurrency > 1)
+                reports.push_back(measure(program, opts.runs, opts.concurrency));
+        }
+        print(reports, opts.json);
+    }
+    catch (const std::exception &e)
+    {
+        std::fprintf(stderr, "greet_startup: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -1,7 +1,18 @@
-#include <iostream>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
+// One write(2) and no iostreams: the program is launched far more often than
+// it has anything to say, so startup is what it is tuned for.
 int main()
 {
-    std::cout << "Hello, World!" << std::endl;
-    return 0;
+    static const char message[] = "Hello, World!\n";
+#ifdef _WIN32
+    int written = _write(1, message, sizeof(message) - 1);
+#else
+    ssize_t written = ::write(1, message, sizeof(message) - 1);
+#endif
+    return written == static_cast<int>(sizeof(message) - 1) ? 0 : 1;
 }
@@ -0,0 +1,389 @@
+#include "subprocess.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+#endif
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+#ifdef _WIN32
+std::string quote(const std::string &arg)
+{
+    std::string out = "\"";
+    for (char c : arg)
+    {
+        if (c == '"')
+            out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+#else
+[[noreturn]] void throw_errno(const char *what)
+{
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Owns the parent's ends of the child's pipes.
+struct Pipes
+{
+    int in = -1;
+    int out = -1;
+    int err = -1;
+
+    ~Pipes()
+    {
+        for (int fd : {in, out, err})
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+    }
+};
+
+// Both ends are close-on-exec; the child only sees the ends dup2()ed onto
+// its standard descriptors. pipe2() sets the flag atomically, so a spawn on
+// another thread cannot inherit the pipe; macOS lacks it and has that race.
+void make_pipe(int fds[2])
+{
+#ifdef __APPLE__
+    if (pipe(fds) != 0)
+        throw_errno("pipe");
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+#else
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        throw_errno("pipe2");
+#endif
+}
+
+// write(2) to a pipe whose reader may be gone, returning EPIPE rather than
+// raising SIGPIPE. The signal is blocked on this thread only and a SIGPIPE
+// caused by this write is consumed, so the process-wide disposition is left
+// alone.
+ssize_t write_without_sigpipe(int fd, const char *data, std::size_t size)
+{
+    sigset_t pipe_set, old_mask, pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_mask);
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE) == 1;
+
+    ssize_t n = ::write(fd, data, size);
+    int saved_errno = errno;
+    if (n < 0 && errno == EPIPE && !was_pending)
+    {
+        sigpending(&pending);
+        int sig;
+        if (sigismember(&pending, SIGPIPE) == 1)
+            sigwait(&pipe_set, &sig);
+    }
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    errno = saved_errno;
+    return n;
+}
+
+// Reap `pid`, waiting until `deadline` at most when `bounded`; a child that
+// is still running then is killed. Returns the wait status.
+int reap(pid_t pid, bool bounded, Clock::time_point deadline, bool &timed_out)
+{
+    int status = 0;
+    auto pause = std::chrono::microseconds(100);
+    for (;;)
+    {
+        pid_t done = waitpid(pid, &status, bounded ? WNOHANG : 0);
+        if (done == pid)
+            return status;
+        if (done < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            throw_errno("waitpid");
+        }
+        if (Clock::now() >= deadline)
+        {
+            timed_out = true;
+            kill(pid, SIGKILL);
+            bounded = false;
+            continue;
+        }
+        std::this_thread::sleep_for(pause);
+        pause = std::min<std::chrono::microseconds>(pause * 2, std::chrono::milliseconds(10));
+    }
+}
+
+std::vector<char *> c_args(const std::vector<std::string> &argv)
+{
+    std::vector<char *> args;
+    for (const std::string &arg : argv)
+        args.push_back(const_cast<char *>(arg.c_str()));
+    args.push_back(nullptr);
+    return args;
+}
+
+// Fill in the exit code or signal from a wait status.
+void set_status(SubprocessResult &result, int status)
+{
+    if (WIFEXITED(status))
+        result.exit_code = WEXITSTATUS(status);
+    else if (WIFSIGNALED(status))
+        result.signal = WTERMSIG(status);
+}
+
+// Read what is available on `fd` into `sink`. Closes the descriptor and sets
+// it to -1 at end of file.
+void drain(int &fd, std::string &sink, std::size_t &total, std::size_t max_capture)
+{
+    char buffer[64 * 1024];
+    for (;;)
+    {
+        ssize_t n = ::read(fd, buffer, sizeof(buffer));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            throw_errno("read");
+        }
+        if (n == 0)
+        {
+            ::close(fd);
+            fd = -1;
+            return;
+        }
+        total += static_cast<std::size_t>(n);
+        if (sink.size() < max_capture)
+            sink.append(buffer, std::min(static_cast<std::size_t>(n), max_capture - sink.size()));
+    }
+}
+#endif
+} // namespace
+
+SubprocessResult run_subprocess(const std::vector<std::string> &argv, const SubprocessOptions &options)
+{
+    if (argv.empty())
+        throw std::invalid_argument("run_subprocess: empty argument list");
+    SubprocessResult result;
+    auto start = Clock::now();
+
+#ifdef _WIN32
+    std::string command;
+    for (const std::string &arg : argv)
+        command += (command.empty() ? "" : " ") + quote(arg);
+    // cmd.exe strips one level of outer quotes from the whole line.
+    FILE *pipe = _popen(("\"" + command + "\"").c_str(), "r");
+    if (!pipe)
+        throw std::system_error(errno, std::generic_category(), "_popen");
+    char buffer[64 * 1024];
+    std::size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+    {
+        result.out_bytes += n;
+        if (result.out.size() < options.max_capture)
+            result.out.append(buffer, std::min(n, options.max_capture - result.out.size()));
+    }
+    result.exit_code = _pclose(pipe);
+    result.wall = Clock::now() - start;
+    return result;
+#else
+    int in_pipe[2] = {-1, -1}, out_pipe[2], err_pipe[2];
+    Pipes pipes;
+    make_pipe(out_pipe);
+    pipes.out = out_pipe[0];
+    make_pipe(err_pipe);
+    pipes.err = err_pipe[0];
+    if (!options.input.empty())
+    {
+        make_pipe(in_pipe);
+        pipes.in = in_pipe[1];
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in_pipe[0] >= 0)
+        posix_spawn_file_actions_adddup2(&actions, in_pipe[0], 0);
+    else
+        posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, err_pipe[1], 2);
+
+    std::vector<char *> args = c_args(argv);
+
+    // Ignored signals stay ignored across exec; the caller may ignore SIGPIPE,
+    // so give the child the default.
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid;
+    int spawn_error = posix_spawn(&pid, argv[0].c_str(), &actions, &attr, args.data(), environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    // The child has its own copies of the other ends now.
+    ::close(out_pipe[1]);
+    ::close(err_pipe[1]);
+    if (in_pipe[0] >= 0)
+        ::close(in_pipe[0]);
+    if (spawn_error != 0)
+        throw std::system_error(spawn_error, std::generic_category(), "posix_spawn " + argv[0]);
+
+    for (int fd : {pipes.in, pipes.out, pipes.err})
+    {
+        if (fd >= 0)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    std::size_t input_sent = 0;
+    auto deadline = start + options.timeout;
+    while (pipes.out >= 0 || pipes.err >= 0)
+    {
+        int wait_ms = -1;
+        if (options.timeout.count() > 0)
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+            if (left <= 0)
+            {
+                result.timed_out = true;
+                kill(pid, SIGKILL);
+                break;
+            }
+            wait_ms = static_cast<int>(std::min<long long>(left, 1000 * 1000));
+        }
+
+        pollfd fds[3];
+        nfds_t count = 0;
+        if (pipes.out >= 0)
+            fds[count++] = {pipes.out, POLLIN, 0};
+        if (pipes.err >= 0)
+            fds[count++] = {pipes.err, POLLIN, 0};
+        if (pipes.in >= 0)
+            fds[count++] = {pipes.in, POLLOUT, 0};
+        int ready = poll(fds, count, wait_ms);
+        if (ready < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            throw_errno("poll");
+        }
+
+        for (nfds_t i = 0; i < count; ++i)
+        {
+            if (fds[i].revents == 0)
+                continue;
+            if (fds[i].fd == pipes.out)
+            {
+                drain(pipes.out, result.out, result.out_bytes, options.max_capture);
+            }
+            else if (fds[i].fd == pipes.err)
+            {
+                drain(pipes.err, result.err, result.err_bytes, options.max_capture);
+            }
+            else
+            {
+                // A child that exits without reading all of its input must not
+                // take the caller down with SIGPIPE.
+                ssize_t n = write_without_sigpipe(pipes.in, options.input.data() + input_sent,
+                                                  options.input.size() - input_sent);
+                if (n > 0)
+                    input_sent += static_cast<std::size_t>(n);
+                // Done, or the child stopped reading (EPIPE): close its stdin.
+                if (input_sent == options.input.size() || (n < 0 && errno != EAGAIN && errno != EINTR))
+                {
+                    ::close(pipes.in);
+                    pipes.in = -1;
+                }
+            }
+        }
+    }
+
+    // The child may close its output and keep running; the timeout covers
+    // that too.
+    int status = reap(pid, options.timeout.count() > 0 && !result.timed_out, deadline, result.timed_out);
+    result.wall = Clock::now() - start;
+    set_status(result, status);
+    return result;
+#endif
+}
+
+#ifndef _WIN32
+BackgroundProcess::BackgroundProcess(const std::vector<std::string> &argv)
+{
+    if (argv.empty())
+        throw std::invalid_argument("BackgroundProcess: empty argument list");
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    std::vector<char *> args = c_args(argv);
+    int spawn_error = posix_spawn(&pid_, argv[0].c_str(), &actions, &attr, args.data(), environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawn_error != 0)
+        throw std::system_error(spawn_error, std::generic_category(), "posix_spawn " + argv[0]);
+}
+
+BackgroundProcess::~BackgroundProcess()
+{
+    if (pid_ > 0)
+    {
+        kill(pid_, SIGKILL);
+        while (waitpid(pid_, nullptr, 0) < 0 && errno == EINTR)
+        {
+        }
+    }
+}
+
+bool BackgroundProcess::running()
+{
+    if (pid_ > 0 && waitpid(pid_, &status_, WNOHANG) == pid_)
+        pid_ = -1;
+    return pid_ > 0;
+}
+
+SubprocessResult BackgroundProcess::stop(std::chrono::milliseconds timeout)
+{
+    SubprocessResult result;
+    auto start = Clock::now();
+    if (running())
+    {
+        kill(pid_, SIGTERM);
+        status_ = reap(pid_, true, start + timeout, result.timed_out);
+        pid_ = -1;
+    }
+    result.wall = Clock::now() - start;
+    set_status(result, status_);
+    return result;
+}
+#endif
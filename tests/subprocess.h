@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+// Run a program and collect what it writes, for tests that exercise the built
+// binaries. On POSIX systems the child is started with posix_spawn() (no
+// shell), and its stdout and stderr are drained concurrently through pipes
+// with poll() and 64 KiB reads. Bulk output therefore neither deadlocks on a
+// full pipe nor crawls through line-at-a-time reads.
+
+struct SubprocessOptions
+{
+    // Written to the child's stdin, which is then closed. Empty: stdin is
+    // /dev/null.
+    std::string input;
+    // Kill the child (SIGKILL) if it has not exited by then; zero waits
+    // forever.
+    std::chrono::milliseconds timeout{10000};
+    // Keep at most this many bytes of each stream; the rest is read and
+    // counted but not stored.
+    std::size_t max_capture = 64 * 1024 * 1024;
+};
+
+struct SubprocessResult
+{
+    int exit_code = -1; // exit status, or -1 if the child did not exit normally
+    int signal = 0;     // signal that ended the child, if any
+    bool timed_out = false;
+    std::string out;
+    std::string err;
+    std::size_t out_bytes = 0; // total bytes written to stdout, stored or not
+    std::size_t err_bytes = 0;
+    std::chrono::nanoseconds wall{0}; // from spawn until the child was reaped
+};
+
+// Run argv[0] (a path, not looked up in PATH) with the given arguments and
+// wait for it. Throws std::system_error if the child cannot be started.
+//
+// Windows fallback: the command runs through _popen(), so only stdout is
+// captured, stderr is inherited, and the timeout is not enforced.
+SubprocessResult run_subprocess(const std::vector<std::string> &argv, const SubprocessOptions &options = {});
+
+#ifndef _WIN32
+#include <sys/types.h>
+
+// A program left running while a test talks to it, such as a server. It is
+// started like run_subprocess() does, with stdin on /dev/null and stdout and
+// stderr shared with the test. The destructor kills and reaps a child that is
+// still running.
+class BackgroundProcess
+{
+public:
+    explicit BackgroundProcess(const std::vector<std::string> &argv);
+    ~BackgroundProcess();
+
+    BackgroundProcess(const BackgroundProcess &) = delete;
+    BackgroundProcess &operator=(const BackgroundProcess &) = delete;
+
+    // Whether the child has exited (and been reaped) yet.
+    bool running();
+
+    // Send SIGTERM and wait up to `timeout` for the child to exit, then
+    // SIGKILL it. Returns what run_subprocess() would have reported, without
+    // any output.
+    SubprocessResult stop(std::chrono::milliseconds timeout = std::chrono::milliseconds(5000));
+
+private:
+    pid_t pid_ = -1;
+    int status_ = 0;
+};
+#endif
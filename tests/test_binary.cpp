@@ -1,58 +1,466 @@
 #include <gtest/gtest.h>
 #include <string>
-#include <array>
-#include <memory>
-#include <stdexcept>
+#include <vector>
+#include "subprocess.h"
+
+#ifndef _WIN32
+#include <csignal>
+#endif
+
+#ifdef __linux__
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 static int g_argc = 0;
 static char **g_argv = nullptr;
 
-// Helper: run a command and capture stdout
-static std::string run_command_capture(const std::string &cmd)
-{
-#ifdef _WIN32
-    std::array<char, 256> buffer;
-    std::string result;
-    FILE *pipe = _popen(cmd.c_str(), "r");
-    if (!pipe)
-        throw std::runtime_error("popen() failed!");
-    while (fgets(buffer.data(), (int)buffer.size(), pipe) != nullptr)
-    {
-        result += buffer.data();
-    }
-    _pclose(pipe);
-    return result;
-#else
-    std::array<char, 256> buffer;
-    std::string result;
-    FILE *pipe = popen(cmd.c_str(), "r");
-    if (!pipe)
-        throw std::runtime_error("popen() failed!");
-    while (fgets(buffer.data(), buffer.size(), pipe) != nullptr)
-    {
-        result += buffer.data();
-    }
-    pclose(pipe);
-    return result;
-#endif
+// Path of the hello_world binary under test, from the first argument.
+static std::string hello_path()
+{
+    return g_argc >= 2 ? std::string(g_argv[1]) : std::string();
+}
+
+// Path of the greet_world binary under test, from the optional second argument.
+static std::string greet_path()
+{
+    return g_argc >= 3 ? std::string(g_argv[2]) : std::string();
 }
 
 TEST(HelloBinaryTest, OutputContainsHelloWorld)
 {
     ASSERT_GE(g_argc, 2) << "Expected binary path as first argument to test.";
-    std::string exePath = std::string(g_argv[1]);
+    SubprocessResult result = run_subprocess({hello_path()});
+    EXPECT_NE(result.out.find("Hello, World!"), std::string::npos) << "Binary output was: " << result.out;
+}
 
-#ifdef _WIN32
-    std::string cmd = "\"" + exePath + "\"";
-#else
-    std::string cmd = exePath;
+TEST(HelloBinaryTest, ExitsCleanlyWithOneLine)
+{
+    ASSERT_GE(g_argc, 2) << "Expected binary path as first argument to test.";
+    SubprocessResult result = run_subprocess({hello_path()});
+    EXPECT_FALSE(result.timed_out);
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result.out, "Hello, World!\n");
+    EXPECT_EQ(result.err, "");
+    EXPECT_GT(result.wall.count(), 0);
+}
+
+class GreetBinaryTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        if (greet_path().empty())
+            GTEST_SKIP() << "greet_world path not given as second argument";
+    }
+};
+
+TEST_F(GreetBinaryTest, PrintsDefaultGreeting)
+{
+    SubprocessResult result = run_subprocess({greet_path()});
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result.out, "Greet, World!\n");
+}
+
+TEST_F(GreetBinaryTest, GreetsNamesFromStdin)
+{
+    SubprocessOptions options;
+    options.input = "Ada\nBob\n";
+    SubprocessResult result = run_subprocess({greet_path(), "--stdin"}, options);
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result.out, "Greet, Ada!\nGreet, Bob!\n");
+    EXPECT_NE(result.err.find("stdin: 2 lines"), std::string::npos) << result.err;
+}
+
+TEST_F(GreetBinaryTest, BulkModeWritesRequestedVolume)
+{
+    // Far more than a pipe holds: stdout and stderr must both keep draining.
+    SubprocessOptions options;
+    options.max_capture = 1024 * 1024;
+    SubprocessResult result = run_subprocess({greet_path(), "--bytes", "67108864"}, options);
+    EXPECT_FALSE(result.timed_out);
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_GE(result.out_bytes, 67108864u);
+    EXPECT_EQ(result.out_bytes % 14, 0u);
+    EXPECT_EQ(result.out.size(), options.max_capture);
+    EXPECT_EQ(result.out.compare(0, 28, "Greet, World!\nGreet, World!\n"), 0);
+    EXPECT_NE(result.err.find("MB/s"), std::string::npos) << result.err;
+}
+
+TEST_F(GreetBinaryTest, PrintsMetricsOnExit)
+{
+    SubprocessResult result = run_subprocess({greet_path(), "--stats", "--count", "3"});
+    EXPECT_EQ(result.exit_code, 0);
+    EXPECT_EQ(result.out, "Greet, World!\nGreet, World!\nGreet, World!\n");
+    EXPECT_NE(result.err.find("counter bytes_written 42\n"), std::string::npos) << result.err;
+}
+
+TEST_F(GreetBinaryTest, ReportsUsageErrors)
+{
+    SubprocessResult result = run_subprocess({greet_path(), "--count", "many"});
+    EXPECT_EQ(result.exit_code, 2);
+    EXPECT_EQ(result.out, "");
+#ifndef _WIN32
+    EXPECT_NE(result.err.find("--count"), std::string::npos) << result.err;
 #endif
+}
 
-    std::string out = run_command_capture(cmd);
-    EXPECT_NE(out.find("Hello, World!"), std::string::npos) << "Binary output was: " << out;
+TEST_F(GreetBinaryTest, RejectsTemplatesOutsideTheNamedModes)
+{
+    // The greeting --count repeats has no name to put in a template.
+    SubprocessResult result = run_subprocess({greet_path(), "--template", "Hi {name}", "--count", "2"});
+    EXPECT_EQ(result.exit_code, 2);
+    EXPECT_EQ(result.out, "");
+    // A bad pattern is caught before the mode is even considered.
+    result = run_subprocess({greet_path(), "--template", "bad{", "--count", "2"});
+    EXPECT_EQ(result.exit_code, 2);
+    EXPECT_EQ(result.out, "");
+}
+
+#ifndef _WIN32
+TEST(SubprocessTest, TimeoutKillsAChildThatNeverExits)
+{
+    SubprocessOptions options;
+    options.timeout = std::chrono::milliseconds(200);
+    SubprocessResult result = run_subprocess({"/bin/sleep", "30"}, options);
+    EXPECT_TRUE(result.timed_out);
+    EXPECT_EQ(result.signal, SIGKILL);
+    EXPECT_EQ(result.exit_code, -1);
+    EXPECT_LT(result.wall, std::chrono::seconds(5));
 }
 
+TEST(SubprocessTest, TimeoutCoversAChildThatClosedItsOutput)
+{
+    SubprocessOptions options;
+    options.timeout = std::chrono::milliseconds(200);
+    SubprocessResult result = run_subprocess({"/bin/sh", "-c", "exec >&- 2>&-; sleep 30"}, options);
+    EXPECT_TRUE(result.timed_out);
+    EXPECT_EQ(result.signal, SIGKILL);
+    EXPECT_LT(result.wall, std::chrono::seconds(5));
+}
+
+TEST(SubprocessTest, UnreadInputDoesNotRaiseSigpipe)
+{
+    // With the default disposition a stray SIGPIPE would end the test binary.
+    auto previous = std::signal(SIGPIPE, SIG_DFL);
+    SubprocessOptions options;
+    options.input.assign(4 * 1024 * 1024, 'x');
+    SubprocessResult result = run_subprocess({"/bin/sh", "-c", "exit 3"}, options);
+    EXPECT_EQ(result.exit_code, 3);
+    EXPECT_EQ(std::signal(SIGPIPE, previous), SIG_DFL);
+}
+#endif
+
+#ifdef __linux__
+// Runs a greet_world server for one test and talks to it over real sockets.
+class GreetServerTest : public GreetBinaryTest
+{
+protected:
+    void SetUp() override
+    {
+        GreetBinaryTest::SetUp();
+        char dir[] = "/tmp/greet_test.XXXXXX";
+        ASSERT_NE(mkdtemp(dir), nullptr);
+        dir_ = dir;
+        socket_path_ = dir_ + "/greet.sock";
+    }
+
+    void TearDown() override
+    {
+        if (server_)
+        {
+            SubprocessResult result = server_->stop();
+            EXPECT_EQ(result.exit_code, 0) << "server did not exit cleanly on SIGTERM";
+        }
+        ::unlink(socket_path_.c_str());
+        ::rmdir(dir_.c_str());
+    }
+
+    void start(const std::vector<std::string> &args)
+    {
+        std::vector<std::string> argv{greet_path()};
+        argv.insert(argv.end(), args.begin(), args.end());
+        server_ = std::make_unique<BackgroundProcess>(argv);
+    }
+
+    // Connect, retrying while the server is still starting. -1 on failure.
+    int connect_unix()
+    {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path_.c_str());
+        return connect_with_retry(AF_UNIX, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    }
+
+    int connect_tcp(int port)
+    {
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<std::uint16_t>(port));
+        return connect_with_retry(AF_INET, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+    }
+
+    // A port nothing listens on right now, chosen by the kernel.
+    static int free_port(int type = SOCK_STREAM)
+    {
+        int fd = socket(AF_INET, type, 0);
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr));
+        getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len);
+        ::close(fd);
+        return ntohs(addr.sin_port);
+    }
+
+    // A UDP socket connected to the server on `port`, once the server answers
+    // on it (datagrams sent before it binds are lost). -1 on failure.
+    int connect_udp(int port)
+    {
+        int fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        timeval timeout{0, 100 * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(static_cast<std::uint16_t>(port));
+        if (connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0)
+        {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+            while (std::chrono::steady_clock::now() < deadline && server_->running())
+            {
+                if (!ask_udp(fd, "").empty())
+                    return fd;
+            }
+        }
+        ::close(fd);
+        return -1;
+    }
+
+    // Send one datagram and return the reply, or "" if none came in time.
+    static std::string ask_udp(int fd, const std::string &request)
+    {
+        ::send(fd, request.data(), request.size(), 0);
+        char reply[4096];
+        ssize_t n = ::recv(fd, reply, sizeof(reply), 0);
+        return n < 0 ? std::string() : std::string(reply, static_cast<std::size_t>(n));
+    }
+
+    static bool send_all(int fd, const std::string &data)
+    {
+        std::size_t sent = 0;
+        while (sent < data.size())
+        {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            sent += static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+    // Everything the server sends until it closes the connection.
+    static std::string receive_all(int fd)
+    {
+        std::string out;
+        char buffer[64 * 1024];
+        ssize_t n;
+        while ((n = ::read(fd, buffer, sizeof(buffer))) > 0)
+            out.append(buffer, static_cast<std::size_t>(n));
+        return out;
+    }
+
+    // Send `request`, half-close, and return the whole reply. The request is
+    // sent from another thread so neither side's buffers can deadlock.
+    static std::string exchange(int fd, const std::string &request)
+    {
+        std::thread writer([fd, &request] {
+            send_all(fd, request);
+            ::shutdown(fd, SHUT_WR);
+        });
+        std::string reply = receive_all(fd);
+        writer.join();
+        ::close(fd);
+        return reply;
+    }
+
+    static std::string repeat(const std::string &s, std::size_t n)
+    {
+        std::string out;
+        out.reserve(s.size() * n);
+        for (std::size_t i = 0; i < n; ++i)
+            out += s;
+        return out;
+    }
+
+    std::string socket_path_;
+
+private:
+    int connect_with_retry(int family, const sockaddr *addr, socklen_t len)
+    {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (std::chrono::steady_clock::now() < deadline && server_->running())
+        {
+            int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (connect(fd, addr, len) == 0)
+                return fd;
+            ::close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return -1;
+    }
+
+    std::string dir_;
+    std::unique_ptr<BackgroundProcess> server_;
+};
+
+TEST_F(GreetServerTest, DropsTruncatedDatagrams)
+{
+    int port = free_port(SOCK_DGRAM);
+    // A bare {name} template would echo the part of an oversized name that fit.
+    start({"--udp", std::to_string(port), "--template", "{name}"});
+    int fd = connect_udp(port);
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(ask_udp(fd, "Ada"), "Ada");
+
+    ::send(fd, std::string(3000, 'x').data(), 3000, 0);
+    EXPECT_EQ(ask_udp(fd, "Bob"), "Bob");
+    ::close(fd);
+}
+
+TEST_F(GreetServerTest, AnswersStatsOverUdp)
+{
+    int port = free_port(SOCK_DGRAM);
+    start({"--udp", std::to_string(port)});
+    int fd = connect_udp(port);
+    ASSERT_GE(fd, 0);
+    std::string stats = ask_udp(fd, "/stats");
+    EXPECT_NE(stats.find("udp_datagrams"), std::string::npos) << stats;
+    EXPECT_LE(stats.size(), 2048u);
+    ::close(fd);
+}
+
+TEST_F(GreetServerTest, AnswersEveryLineBeforeClosingAHalfClosedConnection)
+{
+    start({"--serve", socket_path_});
+    // Whole multiples of the server's 64 KiB reads, so end of input follows a
+    // full read.
+    for (std::size_t lines : {1u, 16384u, 32768u})
+    {
+        int fd = connect_unix();
+        ASSERT_GE(fd, 0);
+        std::string reply = exchange(fd, repeat("Ada\n", lines));
+        EXPECT_EQ(reply, repeat("Greet, Ada!\n", lines)) << lines << " lines";
+    }
+    int fd = connect_unix();
+    ASSERT_GE(fd, 0);
+    EXPECT_EQ(exchange(fd, "\nBob"), "Greet, World!\n"); // an unterminated line is not a request
+}
+
+TEST_F(GreetServerTest, AnswersPipelinedHttpRequests)
+{
+    int port = free_port();
+    start({"--http", std::to_string(port)});
+    int fd = connect_tcp(port);
+    ASSERT_GE(fd, 0);
+    std::string reply = exchange(fd, "GET /greet?name=Ada HTTP/1.1\r\n\r\n"
+                                     "GET /greet HTTP/1.1\r\n\r\n"
+                                     "GET /greet?name=Bob HTTP/1.1\r\nConnection: close\r\n\r\n");
+    std::size_t ada = reply.find("Greet, Ada!\n");
+    std::size_t world = reply.find("Greet, World!\n");
+    std::size_t bob = reply.find("Greet, Bob!\n");
+    ASSERT_NE(bob, std::string::npos) << reply;
+    EXPECT_LT(ada, world);
+    EXPECT_LT(world, bob);
+    EXPECT_NE(reply.find("Connection: close"), std::string::npos) << reply;
+}
+
+TEST_F(GreetServerTest, ReactorsServeManyClients)
+{
+    int port = free_port();
+    start({"--serve", socket_path_, "--http", std::to_string(port), "--reactors", "3"});
+    // Connect everyone before starting any thread, so a failed connect can
+    // return without leaving joinable threads behind.
+    std::vector<int> fds;
+    for (std::size_t i = 0; i < 12; ++i)
+        fds.push_back(i % 2 == 0 ? connect_unix() : connect_tcp(port));
+    if (std::find(fds.begin(), fds.end(), -1) != fds.end())
+    {
+        for (int fd : fds)
+        {
+            if (fd >= 0)
+                ::close(fd);
+        }
+        FAIL() << "could not connect every client";
+    }
+
+    std::vector<std::thread> clients;
+    std::vector<std::string> replies(fds.size());
+    for (std::size_t i = 0; i < fds.size(); ++i)
+    {
+        std::string request = i % 2 == 0 ? repeat("Ada\n", 1000)
+                                         : "GET /greet?name=Ada HTTP/1.1\r\nConnection: close\r\n\r\n";
+        clients.emplace_back([fd = fds[i], request, &reply = replies[i]] { reply = exchange(fd, request); });
+    }
+    for (std::thread &client : clients)
+        client.join();
+    for (std::size_t i = 0; i < replies.size(); ++i)
+    {
+        if (i % 2 == 0)
+            EXPECT_EQ(replies[i], repeat("Greet, Ada!\n", 1000));
+        else
+            EXPECT_NE(replies[i].find("\r\n\r\nGreet, Ada!\n"), std::string::npos) << replies[i];
+    }
+}
+
+TEST_F(GreetServerTest, ClientThatNeverReadsDoesNotStarveOthers)
+{
+    start({"--serve", socket_path_});
+    int flooder = connect_unix();
+    ASSERT_GE(flooder, 0);
+    // Pipelines requests as fast as it can and never reads a reply.
+    std::thread flood([flooder] {
+        std::string chunk = repeat("x\n", 32 * 1024);
+        while (send_all(flooder, chunk))
+        {
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto start_time = std::chrono::steady_clock::now();
+    int fd = connect_unix();
+    // No ASSERT while `flood` is joinable: returning early would terminate.
+    EXPECT_GE(fd, 0);
+    if (fd >= 0)
+    {
+        EXPECT_EQ(exchange(fd, "Ada\n"), "Greet, Ada!\n");
+        EXPECT_LT(std::chrono::steady_clock::now() - start_time, std::chrono::seconds(2));
+    }
+
+    ::shutdown(flooder, SHUT_RDWR);
+    flood.join();
+    ::close(flooder);
+}
+#endif
+
 int main(int argc, char **argv)
 {
     // Save argv for tests
@@ -1,8 +1,1064 @@
 #include <gtest/gtest.h>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <memory_resource>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include "alloc_track.h"
+#include "block_output.h"
 #include "greet.h"
+#include "greet_stream.h"
+#include "greet_template.h"
+#include "http.h"
+#include "line_reader.h"
+#include "metrics.h"
+#include "output.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <cerrno>
+
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "server.h"
+#include "shm_channel.h"
+#endif
+
+// The greeting is built entirely at compile time.
+static_assert(greet_view() == "Greet, World!");
+static_assert(greet_literal("Ada").size() == 11);
+static_assert(std::string_view(greet_literal("Ada").data(), 11) == "Greet, Ada!");
 
 TEST(MainUnitTest, GreetReturnsHelloWorld)
 {
     EXPECT_EQ(greet(), "Greet, World!");
 }
+
+TEST(MainUnitTest, GreetViewMatchesGreet)
+{
+    EXPECT_EQ(greet_view(), greet());
+}
+
+TEST(MainUnitTest, GreetAppendsToString)
+{
+    std::string out = "> ";
+    greet(out);
+    EXPECT_EQ(out, "> Greet, World!");
+}
+
+TEST(MainUnitTest, GreetIntoBufferReportsLength)
+{
+    std::array<char, 64> buffer{};
+    std::size_t n = greet(buffer.data(), buffer.size());
+    EXPECT_EQ(std::string(buffer.data(), n), "Greet, World!");
+
+    // Too small: nothing is written but the required size is still returned.
+    std::array<char, 4> tiny{};
+    EXPECT_EQ(greet(tiny.data(), tiny.size()), n);
+    EXPECT_EQ(tiny[0], '\0');
+}
+
+TEST(MainUnitTest, GreetViewPathNeverAllocates)
+{
+    std::array<char, 64> buffer{};
+    std::string reserved;
+    reserved.reserve(64);
+
+    AllocationScope scope;
+    std::string_view view = greet_view();
+    std::size_t n = greet(buffer.data(), buffer.size());
+    greet(reserved);
+
+    EXPECT_EQ(scope.allocations(), 0u);
+    EXPECT_EQ(view.size(), n);
+    EXPECT_EQ(reserved, view);
+}
+
+TEST(GreetTemplateTest, RendersName)
+{
+    GreetTemplate tmpl("Greet, {name}!");
+    std::string out;
+    tmpl.render("Ada", out);
+    tmpl.render("World", out);
+    EXPECT_EQ(out, "Greet, Ada!Greet, World!");
+    EXPECT_EQ(tmpl.rendered_size("World"), greet_view().size());
+}
+
+TEST(GreetTemplateTest, HandlesEscapesAndRepeats)
+{
+    GreetTemplate tmpl("{{{name}}} and {name}");
+    std::string out;
+    tmpl.render("x", out);
+    EXPECT_EQ(out, "{x} and x");
+}
+
+TEST(GreetTemplateTest, RejectsMalformedPatterns)
+{
+    EXPECT_THROW(GreetTemplate("Greet, {who}!"), std::invalid_argument);
+    EXPECT_THROW(GreetTemplate("Greet, }"), std::invalid_argument);
+}
+
+TEST(GreetTemplateTest, RenderIntoBufferNeverAllocates)
+{
+    GreetTemplate tmpl("Greet, {name}!");
+    std::array<char, 64> buffer{};
+
+    AllocationScope scope;
+    std::size_t n = tmpl.render("Ada", buffer.data(), buffer.size());
+    std::size_t too_big = tmpl.render("Ada", buffer.data(), 4);
+
+    EXPECT_EQ(scope.allocations(), 0u);
+    EXPECT_EQ(std::string(buffer.data(), n), "Greet, Ada!");
+    EXPECT_EQ(too_big, n);
+}
+
+TEST(GreetBatchTest, RendersEveryNameContiguously)
+{
+    std::vector<std::string_view> names = {"Ada", "", "World"};
+    GreetBatch batch;
+    greet_batch(names.data(), names.size(), batch);
+
+    ASSERT_EQ(batch.size(), 3u);
+    EXPECT_EQ(batch[0], "Greet, Ada!");
+    EXPECT_EQ(batch[1], "Greet, !");
+    EXPECT_EQ(batch[2], greet_view());
+    EXPECT_EQ(batch.data, "Greet, Ada!Greet, !Greet, World!");
+}
+
+TEST(GreetBatchTest, ReusedBatchDoesNotAllocate)
+{
+    std::vector<std::string_view> names = {"Ada", "Grace", "Edsger"};
+    GreetTemplate tmpl("Hi {name}");
+    GreetBatch batch;
+    greet_batch(names.data(), names.size(), batch, tmpl);
+
+    std::vector<std::string_view> next = {"Alan", "Barbara", "Ken"};
+    AllocationScope scope;
+    greet_batch(next.data(), next.size(), batch, tmpl);
+
+    EXPECT_EQ(scope.allocations(), 0u);
+    EXPECT_EQ(batch[1], "Hi Barbara");
+}
+
+TEST(GreetArenaTest, TemplateRendersIntoArena)
+{
+    std::array<std::byte, 256> storage;
+    std::pmr::monotonic_buffer_resource arena(storage.data(), storage.size(),
+                                              std::pmr::null_memory_resource());
+    GreetTemplate tmpl("Greet, {name}!");
+
+    AllocationScope scope;
+    std::string_view a = tmpl.render("Ada", arena);
+    std::string_view b = tmpl.render("Grace", arena);
+
+    EXPECT_EQ(scope.allocations(), 0u);
+    EXPECT_EQ(a, "Greet, Ada!");
+    EXPECT_EQ(b, "Greet, Grace!");
+
+    // Releasing the arena resets it in bulk; the next batch reuses the storage.
+    arena.release();
+    EXPECT_EQ(tmpl.render("Ken", arena).data(), a.data());
+}
+
+TEST(GreetArenaTest, BatchAllocatesFromArena)
+{
+    std::array<std::byte, 1024> storage;
+    std::pmr::monotonic_buffer_resource arena(storage.data(), storage.size(),
+                                              std::pmr::null_memory_resource());
+    std::vector<std::string_view> names = {"Ada", "Grace", "Edsger", "Barbara", "Ken"};
+    GreetTemplate tmpl(kGreetPattern);
+
+    AllocationScope scope;
+    {
+        GreetBatch batch(&arena);
+        greet_batch(names.data(), names.size(), batch, tmpl);
+        EXPECT_EQ(batch[3], "Greet, Barbara!");
+    }
+    arena.release();
+
+    EXPECT_EQ(scope.allocations(), 0u);
+}
+
+static int file_descriptor(std::FILE *file)
+{
+#ifdef _WIN32
+    return _fileno(file);
+#else
+    return fileno(file);
+#endif
+}
+
+static std::string read_back(std::FILE *file)
+{
+    std::string contents;
+    std::array<char, 4096> chunk;
+    std::rewind(file);
+    while (std::size_t n = std::fread(chunk.data(), 1, chunk.size(), file))
+        contents.append(chunk.data(), n);
+    return contents;
+}
+
+TEST(OutputWriterTest, BuffersUntilFlushed)
+{
+    std::FILE *file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    int fd = file_descriptor(file);
+    {
+        OutputWriter out(fd, FlushPolicy::None);
+        out.write_line(greet_view());
+        out.write("second");
+        EXPECT_EQ(out.bytes_written(), 0u);
+        out.flush();
+        EXPECT_EQ(out.bytes_written(), greet_view().size() + 7);
+        out.write_line("");
+    }
+
+    std::string contents = read_back(file);
+    std::fclose(file);
+    EXPECT_EQ(contents, "Greet, World!\nsecond\n");
+}
+
+TEST(OutputWriterTest, WritesWithoutAllocating)
+{
+    std::FILE *file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    {
+        OutputWriter out(file_descriptor(file), FlushPolicy::Block, OutputWriter::kBlockSize);
+        AllocationScope scope;
+        for (int i = 0; i < 10000; ++i)
+            out.write_line(greet_view());
+        out.flush();
+        EXPECT_EQ(scope.allocations(), 0u);
+    }
+    std::fclose(file);
+}
+
+TEST(OutputWriterTest, ParsesFlushPolicies)
+{
+    EXPECT_EQ(parse_flush_policy("line"), FlushPolicy::Line);
+    EXPECT_EQ(parse_flush_policy("block"), FlushPolicy::Block);
+    EXPECT_EQ(parse_flush_policy("none"), FlushPolicy::None);
+    EXPECT_THROW(parse_flush_policy("always"), std::invalid_argument);
+}
+
+TEST(BlockOutputTest, EveryBackendWritesTheSameBytes)
+{
+    const std::string line = "Greet, World!\n";
+    // Enough lines to span several pre-rendered blocks plus a partial one.
+    const std::uint64_t count = 12345;
+    std::string expected;
+    for (std::uint64_t i = 0; i < count; ++i)
+        expected += line;
+
+    for (OutputBackend backend :
+         {OutputBackend::Write, OutputBackend::Writev, OutputBackend::Vmsplice, OutputBackend::IoUring})
+    {
+        std::FILE *file = std::tmpfile();
+        ASSERT_NE(file, nullptr);
+        int fd = file_descriptor(file);
+        OutputBackend resolved = resolve_output_backend(fd, backend);
+        EXPECT_EQ(emit_repeated(fd, line, count, resolved), expected.size()) << to_string(backend);
+        EXPECT_EQ(read_back(file), expected) << to_string(backend);
+        std::fclose(file);
+    }
+}
+
+TEST(BlockOutputTest, EveryBackendContinuesFromTheFilePosition)
+{
+    const std::string line = "Greet, World!\n";
+    const std::uint64_t count = 50000;
+    std::string expected = "before\n";
+    for (std::uint64_t i = 0; i < count; ++i)
+        expected += line;
+    expected += "after\n";
+
+    for (OutputBackend backend :
+         {OutputBackend::Write, OutputBackend::Writev, OutputBackend::Vmsplice, OutputBackend::IoUring})
+    {
+        std::FILE *file = std::tmpfile();
+        ASSERT_NE(file, nullptr);
+        int fd = file_descriptor(file);
+        write_all(fd, "before\n", 7);
+        emit_repeated(fd, line, count, resolve_output_backend(fd, backend));
+        write_all(fd, "after\n", 6);
+        EXPECT_EQ(read_back(file), expected) << to_string(backend);
+        std::fclose(file);
+    }
+}
+
+#ifndef _WIN32
+// Everything written to a pipe, read on a thread of its own so the writer can
+// run ahead by at most the pipe's capacity.
+class PipeReader
+{
+public:
+    PipeReader()
+    {
+        if (pipe(fds_) != 0)
+            throw std::system_error(errno, std::generic_category(), "pipe");
+        thread_ = std::thread([this] {
+            char buffer[16 * 1024];
+            for (;;)
+            {
+                ssize_t n = read(fds_[0], buffer, sizeof(buffer));
+                if (n > 0)
+                    contents_.append(buffer, static_cast<std::size_t>(n));
+                else if (n == 0 || errno != EINTR)
+                    break;
+            }
+        });
+    }
+
+    ~PipeReader()
+    {
+        if (fds_[1] >= 0)
+            close(fds_[1]);
+        if (thread_.joinable())
+            thread_.join();
+        close(fds_[0]);
+    }
+
+    int fd() const { return fds_[1]; }
+
+    // Close the write end and return everything the pipe carried.
+    std::string finish()
+    {
+        close(fds_[1]);
+        fds_[1] = -1;
+        thread_.join();
+        return contents_;
+    }
+
+private:
+    int fds_[2] = {-1, -1};
+    std::thread thread_;
+    std::string contents_;
+};
+
+TEST(BlockOutputTest, EveryBackendWritesTheSameBytesToAPipe)
+{
+    const std::string line = "Greet, World!\n";
+    const std::uint64_t count = 50000;
+    std::string expected;
+    for (std::uint64_t i = 0; i < count; ++i)
+        expected += line;
+
+    for (OutputBackend backend :
+         {OutputBackend::Write, OutputBackend::Writev, OutputBackend::Vmsplice, OutputBackend::IoUring})
+    {
+        PipeReader reader;
+        OutputBackend resolved = resolve_output_backend(reader.fd(), backend);
+#ifdef __linux__
+        if (backend == OutputBackend::Vmsplice)
+        {
+            EXPECT_EQ(resolved, OutputBackend::Vmsplice);
+        }
+#endif
+        EXPECT_EQ(emit_repeated(reader.fd(), line, count, resolved), expected.size()) << to_string(backend);
+        // Spliced pages may still be queued in the pipe; reusing the heap
+        // must not change what the reader sees.
+        std::vector<std::vector<char>> scribble;
+        for (int i = 0; i < 8; ++i)
+            scribble.emplace_back(70 * 1024, '#');
+        std::string contents = reader.finish();
+        EXPECT_EQ(contents.size(), expected.size()) << to_string(backend);
+        EXPECT_TRUE(contents == expected) << to_string(backend);
+    }
+}
+#endif
+
+TEST(BlockOutputTest, ParsesBackendNames)
+{
+    EXPECT_EQ(parse_output_backend("writev"), OutputBackend::Writev);
+    EXPECT_STREQ(to_string(parse_output_backend("vmsplice")), "vmsplice");
+    EXPECT_THROW(parse_output_backend("sendfile"), std::invalid_argument);
+}
+
+static std::FILE *file_with(std::string_view contents)
+{
+    std::FILE *file = std::tmpfile();
+    if (file != nullptr)
+    {
+        std::fwrite(contents.data(), 1, contents.size(), file);
+        std::fflush(file);
+        std::rewind(file);
+    }
+    return file;
+}
+
+TEST(LineReaderTest, SplitsLinesAcrossRefills)
+{
+    // A tiny buffer forces lines to straddle reads and to outgrow the buffer.
+    std::FILE *file = file_with("Ada\r\nGrace Hopper\n\nthe-last-line-is-unterminated");
+    ASSERT_NE(file, nullptr);
+    LineReader reader(file_descriptor(file), 4);
+
+    std::vector<std::string> lines;
+    std::string_view line;
+    while (reader.next(line))
+        lines.emplace_back(line);
+    std::fclose(file);
+
+    std::vector<std::string> expected = {"Ada", "Grace Hopper", "", "the-last-line-is-unterminated"};
+    EXPECT_EQ(lines, expected);
+}
+
+TEST(GreetStreamTest, GreetsEveryName)
+{
+    std::FILE *in = file_with("Ada\nGrace\n");
+    std::FILE *out = std::tmpfile();
+    ASSERT_NE(in, nullptr);
+    ASSERT_NE(out, nullptr);
+
+    StreamStats stats = greet_stream(file_descriptor(in), file_descriptor(out), GreetTemplate(kGreetPattern),
+                                     FlushPolicy::Block);
+    EXPECT_EQ(stats.lines, 2u);
+    EXPECT_EQ(read_back(out), "Greet, Ada!\nGreet, Grace!\n");
+    EXPECT_EQ(stats.bytes, 26u);
+    std::fclose(in);
+    std::fclose(out);
+}
+
+TEST(GreetStreamTest, ParallelKeepsInputOrder)
+{
+    // Enough input for several chunks, so workers finish out of order.
+    std::string names;
+    std::string expected;
+    for (int i = 0; i < 300000; ++i)
+    {
+        std::string name = "name" + std::to_string(i);
+        names += name + "\n";
+        expected += "Greet, " + name + "!\n";
+    }
+    names += "last";
+    expected += "Greet, last!\n";
+
+    std::FILE *in = file_with(names);
+    std::FILE *out = std::tmpfile();
+    ASSERT_NE(in, nullptr);
+    ASSERT_NE(out, nullptr);
+
+    StreamStats stats =
+        greet_stream_parallel(file_descriptor(in), file_descriptor(out), GreetTemplate(kGreetPattern), 4);
+    EXPECT_EQ(stats.lines, 300001u);
+    EXPECT_EQ(stats.bytes, expected.size());
+    EXPECT_EQ(read_back(out), expected);
+    std::fclose(in);
+    std::fclose(out);
+}
+
+TEST(GreetStreamTest, ParallelRejectsOverlongLines)
+{
+    std::FILE *in = file_with("Ada\n" + std::string(3 * 1024 * 1024, 'x') + "\nGrace\n");
+    std::FILE *out = std::tmpfile();
+    ASSERT_NE(in, nullptr);
+    ASSERT_NE(out, nullptr);
+    EXPECT_THROW(greet_stream_parallel(file_descriptor(in), file_descriptor(out), GreetTemplate(kGreetPattern), 2),
+                 std::runtime_error);
+    std::fclose(in);
+    std::fclose(out);
+}
+
+#ifdef __linux__
+TEST(GreetStreamTest, ParallelStopsReadingWhenTheWriterFails)
+{
+    // More than a chunk of names, then an input that stays open and silent:
+    // the reader is left blocked in read() when the write fails.
+    int input[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, input), 0);
+    std::thread sender([fd = input[1]] {
+        std::string names;
+        for (int i = 0; i < 200000; ++i)
+            names += "name" + std::to_string(i) + "\n";
+        std::size_t sent = 0;
+        while (sent < names.size())
+        {
+            ssize_t n = send(fd, names.data() + sent, names.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+                break;
+            sent += static_cast<std::size_t>(n);
+        }
+    });
+    int unwritable = open("/dev/null", O_RDONLY);
+    ASSERT_GE(unwritable, 0);
+
+    EXPECT_THROW(greet_stream_parallel(input[0], unwritable, GreetTemplate(kGreetPattern), 2), std::system_error);
+
+    close(input[0]);
+    sender.join();
+    close(input[1]);
+    close(unwritable);
+}
+#endif
+
+#ifndef _WIN32
+TEST(GreetStreamTest, MappedFileMatchesStdinPath)
+{
+    char path[] = "/tmp/greet_input_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    std::string names;
+    for (int i = 0; i < 200000; ++i)
+        names += "name" + std::to_string(i) + (i % 3 == 0 ? "\r\n" : "\n");
+    write_all(fd, names.data(), names.size());
+
+    std::FILE *in = file_with(names);
+    std::FILE *from_stdin = std::tmpfile();
+    std::FILE *from_file = std::tmpfile();
+    GreetTemplate tmpl(kGreetPattern);
+    greet_stream(file_descriptor(in), file_descriptor(from_stdin), tmpl, FlushPolicy::Block);
+    StreamStats stats = greet_file_parallel(path, file_descriptor(from_file), tmpl, 3);
+
+    EXPECT_EQ(stats.lines, 200000u);
+    EXPECT_EQ(read_back(from_file), read_back(from_stdin));
+    std::fclose(in);
+    std::fclose(from_stdin);
+    std::fclose(from_file);
+    close(fd);
+    unlink(path);
+}
+#endif
+
+TEST(HttpGreeterTest, AnswersPipelinedRequestsInOrder)
+{
+    GreetTemplate tmpl(kGreetPattern);
+    HttpGreeter http(tmpl);
+    std::string in = "GET /greet HTTP/1.1\r\nHost: x\r\n\r\n"
+                     "GET /greet?name=Ada+L%2e HTTP/1.1\r\n\r\n"
+                     "GET /gre";
+    std::string out;
+    bool close = false;
+
+    std::size_t consumed = http.handle(in, out, close);
+    EXPECT_FALSE(close);
+    EXPECT_EQ(in.substr(consumed), "GET /gre");
+    EXPECT_EQ(out, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 14\r\n\r\nGreet, World!\n"
+                   "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 15\r\n\r\nGreet, Ada L.!\n");
+}
+
+TEST(HttpGreeterTest, SteadyStateRequestsDoNotAllocate)
+{
+    GreetTemplate tmpl(kGreetPattern);
+    HttpGreeter http(tmpl);
+    std::string in = "GET /greet HTTP/1.1\r\n\r\nGET /greet?name=Ada HTTP/1.1\r\n\r\n";
+    std::string out;
+    bool close = false;
+    http.handle(in, out, close); // sizes the output and scratch buffers
+
+    AllocationScope scope;
+    for (int i = 0; i < 100; ++i)
+    {
+        out.clear();
+        http.handle(in, out, close);
+    }
+    EXPECT_EQ(scope.allocations(), 0u);
+}
+
+TEST(HttpGreeterTest, HonoursConnectionClose)
+{
+    GreetTemplate tmpl(kGreetPattern);
+    HttpGreeter http(tmpl);
+    std::string in = "GET /greet HTTP/1.1\r\nConnection: close\r\n\r\nGET /greet HTTP/1.1\r\n\r\n";
+    std::string out;
+    bool close = false;
+
+    std::size_t consumed = http.handle(in, out, close);
+    EXPECT_TRUE(close);
+    EXPECT_EQ(consumed, in.find("GET", 1));
+    EXPECT_NE(out.find("Connection: close\r\n"), std::string::npos);
+
+    // HTTP/1.0 closes by default.
+    out.clear();
+    close = false;
+    http.handle("GET /greet HTTP/1.0\r\n\r\n", out, close);
+    EXPECT_TRUE(close);
+}
+
+TEST(HttpGreeterTest, ConfirmsHttp10KeepAlive)
+{
+    GreetTemplate tmpl(kGreetPattern);
+    HttpGreeter http(tmpl);
+    std::string out;
+    bool close = false;
+
+    http.handle("GET /greet HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", out, close);
+    EXPECT_FALSE(close);
+    EXPECT_EQ(out, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 14\r\n"
+                   "Connection: keep-alive\r\n\r\nGreet, World!\n");
+
+    // HTTP/1.1 keeps the connection by default and needs no header.
+    out.clear();
+    http.handle("GET /greet?name=Ada HTTP/1.1\r\n\r\n", out, close);
+    EXPECT_EQ(out.find("Connection:"), std::string::npos) << out;
+}
+
+TEST(HttpGreeterTest, AcceptsBareLineFeeds)
+{
+    GreetTemplate tmpl(kGreetPattern);
+    HttpGreeter http(tmpl);
+    std::string in = "GET /greet?name=Ada HTTP/1.1\nHost: x\n\n"
+                     "GET /greet HTTP/1.1\r\nHost: x\n\r\n"
+                     "GET /greet HTTP/1.1\n";
+    std::string out;
+    bool close = false;
+
+    std::size_t consumed = http.handle(in, out, close);
+    EXPECT_FALSE(close);
+    EXPECT_EQ(in.substr(consumed), "GET /greet HTTP/1.1\n");
+    EXPECT_EQ(out, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 12\r\n\r\nGreet, Ada!\n"
+                   "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 14\r\n\r\nGreet, World!\n");
+}
+
+TEST(HttpGreeterTest, RejectsUnsupportedRequests)
+{
+    GreetTemplate tmpl(kGreetPattern);
+    HttpGreeter http(tmpl);
+    std::string out;
+    bool close = false;
+
+    http.handle("GET /other HTTP/1.1\r\n\r\n", out, close);
+    EXPECT_EQ(out.rfind("HTTP/1.1 404", 0), 0u);
+    EXPECT_FALSE(close);
+
+    out.clear();
+    http.handle("POST /greet HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc", out, close);
+    EXPECT_EQ(out.rfind("HTTP/1.1 400", 0), 0u);
+    EXPECT_TRUE(close);
+
+    out.clear();
+    close = false;
+    http.handle(std::string(HttpGreeter::kMaxHead + 1, 'x'), out, close);
+    EXPECT_EQ(out.rfind("HTTP/1.1 431", 0), 0u);
+    EXPECT_TRUE(close);
+    EXPECT_EQ(http.requests(), 3u);
+}
+
+TEST(HttpGreeterTest, ServesMetricsText)
+{
+    metrics().counter("test.http_stats").add(7);
+    GreetTemplate tmpl(kGreetPattern);
+    HttpGreeter http(tmpl);
+    std::string out;
+    bool close = false;
+
+    http.handle("GET /stats HTTP/1.1\r\n\r\n", out, close);
+    EXPECT_EQ(out.rfind("HTTP/1.1 200", 0), 0u);
+    EXPECT_NE(out.find("\r\n\r\ncounter "), std::string::npos) << out;
+    EXPECT_NE(out.find("counter test.http_stats 7\n"), std::string::npos) << out;
+    EXPECT_FALSE(close);
+}
+
+TEST(MetricsTest, HistogramBucketsKeepRelativeError)
+{
+    EXPECT_EQ(Histogram::bucket_of(0), 0u);
+    EXPECT_EQ(Histogram::bucket_of(15), 15u);
+    EXPECT_EQ(Histogram::bucket_of(16), 16u);
+    EXPECT_EQ(Histogram::bucket_of(31), 31u);
+    EXPECT_EQ(Histogram::bucket_of(32), 32u);
+    EXPECT_EQ(Histogram::bucket_of(33), 32u);
+    EXPECT_EQ(Histogram::bucket_of(~std::uint64_t(0)), Histogram::kBuckets - 1);
+
+    for (std::uint64_t value : {1ull, 17ull, 1000ull, 123456ull, 987654321ull, 1ull << 40})
+    {
+        Histogram h;
+        h.record(value);
+        double reported = static_cast<double>(h.percentile(50));
+        EXPECT_NEAR(reported, static_cast<double>(value), value / 16.0) << value;
+    }
+}
+
+TEST(MetricsTest, HistogramPercentiles)
+{
+    Histogram h;
+    EXPECT_EQ(h.percentile(99), 0u);
+    for (std::uint64_t v = 1; v <= 10000; ++v)
+        h.record(v);
+
+    EXPECT_EQ(h.count(), 10000u);
+    EXPECT_EQ(h.sum(), 10000u * 10001u / 2);
+    EXPECT_EQ(h.max(), 10000u);
+    EXPECT_NEAR(static_cast<double>(h.percentile(50)), 5000.0, 5000.0 / 16);
+    EXPECT_NEAR(static_cast<double>(h.percentile(99)), 9900.0, 9900.0 / 16);
+    EXPECT_EQ(h.percentile(100), 10000u);
+}
+
+TEST(MetricsTest, ConcurrentRecordingLosesNothing)
+{
+    Counter &counter = metrics().counter("test.concurrent");
+    Histogram &histogram = metrics().histogram("test.concurrent_ns");
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&] {
+            for (int i = 0; i < 10000; ++i)
+            {
+                counter.add();
+                histogram.record(static_cast<std::uint64_t>(i));
+            }
+        });
+    }
+    for (std::thread &thread : threads)
+        thread.join();
+
+    EXPECT_EQ(counter.value(), 40000u);
+    EXPECT_EQ(histogram.count(), 40000u);
+    EXPECT_EQ(histogram.max(), 9999u);
+}
+
+TEST(MetricsTest, RegistryReturnsTheSameMetricAndRendersIt)
+{
+    MetricsRegistry registry;
+    registry.counter("requests").add(3);
+    registry.counter("requests").add(2);
+    registry.gauge("open").set(-1);
+    registry.histogram("latency_ns").record(100);
+    EXPECT_EQ(&registry.counter("requests"), &registry.counter("requests"));
+
+    EXPECT_EQ(registry.render_text(), "counter requests 5\n"
+                                      "gauge open -1\n"
+                                      "histogram latency_ns count=1 mean=100 p50=100 p90=100 p99=100 p99.9=100 "
+                                      "max=100\n");
+}
+
+TEST(MetricsTest, ShardsAreReportedAsOneMetric)
+{
+    MetricsRegistry registry;
+    registry.counter("requests").add(1);
+    Counter &a = registry.counter_shard("requests");
+    Counter &b = registry.counter_shard("requests");
+    EXPECT_NE(&a, &b);
+    a.add(10);
+    b.add(100);
+    registry.gauge_shard("open").add(2);
+    registry.gauge_shard("open").add(-1);
+    registry.histogram_shard("latency_ns").record(100);
+    registry.histogram_shard("latency_ns").record(300);
+
+    EXPECT_EQ(registry.render_text(), "counter requests 111\n"
+                                      "gauge open 1\n"
+                                      "histogram latency_ns count=2 mean=200 p50=102 p90=300 p99=300 p99.9=300 "
+                                      "max=300\n");
+}
+
+TEST(MetricsTest, OutputWriterTimesWritesOnlyWhenEnabled)
+{
+    std::FILE *file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    Histogram &write_ns = metrics().histogram("write_ns");
+    std::uint64_t before = write_ns.count();
+    {
+        OutputWriter out(file_descriptor(file), FlushPolicy::Line);
+        out.write_line("untimed");
+    }
+    EXPECT_EQ(write_ns.count(), before);
+
+    enable_metrics_timing(true);
+    {
+        OutputWriter out(file_descriptor(file), FlushPolicy::Line);
+        out.write_line("timed");
+        out.write_line("timed");
+    }
+    enable_metrics_timing(false);
+    EXPECT_EQ(write_ns.count(), before + 2);
+    std::fclose(file);
+}
+
+TEST(MetricsTest, RecordingDoesNotAllocate)
+{
+    Counter &counter = metrics().counter("test.no_alloc");
+    Histogram &histogram = metrics().histogram("test.no_alloc_ns");
+    AllocationScope scope;
+    for (std::uint64_t i = 0; i < 1000; ++i)
+    {
+        counter.add();
+        histogram.record(i * i);
+    }
+    EXPECT_EQ(scope.allocations(), 0u);
+}
+
+// Publishing a pointer keeps the compiler from eliding a new/delete pair.
+static const void *volatile g_escape;
+
+TEST(AllocationScopeTest, CountsAllocationsOnThisThread)
+{
+    AllocationScope scope;
+    auto value = std::make_unique<std::array<char, 100>>();
+    std::string grown(1000, 'x');
+    g_escape = value.get();
+    g_escape = grown.data();
+    AllocationStats stats = scope.stats();
+
+    EXPECT_EQ(stats.allocations, 2u);
+    EXPECT_GE(stats.bytes, 1100u);
+    EXPECT_EQ(stats.deallocations, 0u);
+    value.reset();
+    EXPECT_EQ(scope.stats().deallocations, 1u);
+}
+
+TEST(AllocationScopeTest, OtherThreadsOnlyCountWhenAsked)
+{
+    AllocationScope mine;
+    AllocationScope all(AllocationScope::Threads::All);
+    std::thread worker([] { g_escape = std::make_unique<int>(1).get(); });
+    worker.join();
+
+    // Starting the thread may allocate on this one; the worker's own
+    // allocation only shows up in the process-wide scope.
+    EXPECT_GE(all.allocations(), mine.allocations() + 1);
+}
+
+#ifdef __GLIBC__
+TEST(AllocationScopeTest, CountsMalloc)
+{
+    AllocationScope scope;
+    void *p = std::malloc(64);
+    g_escape = p;
+    std::free(p);
+    EXPECT_EQ(scope.allocations(), 1u);
+    EXPECT_EQ(scope.stats().deallocations, 1u);
+}
+
+TEST(AllocationScopeTest, CountsAlignedAllocations)
+{
+    AllocationScope scope;
+    void *p = nullptr;
+    ASSERT_EQ(posix_memalign(&p, 64, 100), 0);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p) % 64, 0u);
+    g_escape = p;
+    std::free(p);
+    p = aligned_alloc(4096, 4096);
+    ASSERT_NE(p, nullptr);
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(p) % 4096, 0u);
+    g_escape = p;
+    std::free(p);
+    EXPECT_EQ(posix_memalign(&p, 3, 100), EINVAL);
+
+    AllocationStats stats = scope.stats();
+    EXPECT_EQ(stats.allocations, 2u);
+    EXPECT_EQ(stats.bytes, 4196u);
+    EXPECT_EQ(stats.deallocations, 2u);
+}
+#endif
+
+TEST(AllocationScopeTest, AttributesAllocationsToCallSites)
+{
+    track_allocation_sites(true);
+    for (int i = 0; i < 1000; ++i)
+        g_escape = std::make_unique<std::array<char, 256>>().get();
+    track_allocation_sites(false);
+
+    std::vector<AllocationSite> sites = top_allocation_sites(1);
+    ASSERT_EQ(sites.size(), 1u);
+    EXPECT_GE(sites[0].allocations, 1000u);
+    EXPECT_GE(sites[0].bytes, 256000u);
+    EXPECT_FALSE(sites[0].where.empty());
+}
+
+#ifdef __linux__
+// A channel created and attached in-process, under a name unique to the test.
+class ShmChannelTest : public ::testing::Test
+{
+protected:
+    ShmChannelTest()
+        : name_("/greet_test_" + std::to_string(getpid()) + "_" +
+                ::testing::UnitTest::GetInstance()->current_test_info()->name()),
+          service_(ShmChannel::create(name_))
+    {
+        service_.set_spin(0);
+    }
+
+    std::string name_;
+    ShmChannel service_;
+};
+
+TEST_F(ShmChannelTest, RoundTripsRequestsAndResponses)
+{
+    ShmChannel client = ShmChannel::open(name_);
+    std::string message;
+    client.send_request("Ada");
+    client.send_request("");
+    ASSERT_TRUE(service_.receive_request(message));
+    EXPECT_EQ(message, "Ada");
+    service_.send_response("Greet, Ada!");
+    ASSERT_TRUE(service_.receive_request(message));
+    EXPECT_EQ(message, "");
+    service_.send_response("Greet, World!");
+
+    ASSERT_TRUE(client.receive_response(message));
+    EXPECT_EQ(message, "Greet, Ada!");
+    ASSERT_TRUE(client.receive_response(message));
+    EXPECT_EQ(message, "Greet, World!");
+    EXPECT_THROW(client.send_request(std::string(ShmChannel::kMaxMessage + 1, 'x')), std::invalid_argument);
+}
+
+TEST(ShmServiceTest, AnswersStats)
+{
+    std::string name = "/greet_test_" + std::to_string(getpid()) + "_service";
+    std::thread service([&] { run_shm_service(name, GreetTemplate(kGreetPattern), 0); });
+    // The service creates the segment; attach once it exists.
+    std::unique_ptr<ShmChannel> client;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!client && std::chrono::steady_clock::now() < deadline)
+    {
+        try
+        {
+            client = std::make_unique<ShmChannel>(ShmChannel::open(name));
+        }
+        catch (const std::exception &)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    if (client)
+    {
+        std::string message;
+        client->send_request("Ada");
+        ASSERT_TRUE(client->receive_response(message));
+        EXPECT_EQ(message, "Greet, Ada!");
+        client->send_request("/stats");
+        ASSERT_TRUE(client->receive_response(message));
+        EXPECT_NE(message.find("requests"), std::string::npos) << message;
+    }
+    EXPECT_TRUE(client != nullptr);
+
+    // The service stops on SIGTERM through the handler it installed.
+    std::raise(SIGTERM);
+    service.join();
+    std::signal(SIGTERM, SIG_DFL);
+    std::signal(SIGINT, SIG_DFL);
+}
+
+TEST_F(ShmChannelTest, MessagesSurviveWrappingTheRing)
+{
+    ShmChannel client = ShmChannel::open(name_);
+    // An odd size, so records end at every offset and some straddle the end
+    // of the ring, forcing wrap markers.
+    std::string message;
+    for (int i = 0; i < 100; ++i)
+    {
+        std::string payload(ShmChannel::kMaxMessage - 1 - i, static_cast<char>('a' + i % 26));
+        client.send_request(payload);
+        ASSERT_TRUE(service_.receive_request(message));
+        ASSERT_EQ(message, payload) << i;
+        service_.send_response(payload);
+        ASSERT_TRUE(client.receive_response(message));
+        ASSERT_EQ(message, payload) << i;
+    }
+}
+
+TEST_F(ShmChannelTest, ReceiveReturnsWhenStopped)
+{
+    std::atomic<bool> stop{false};
+    std::thread stopper([&stop] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        stop = true;
+    });
+    std::string message;
+    EXPECT_FALSE(service_.receive_request(message, &stop));
+    stopper.join();
+}
+
+TEST_F(ShmChannelTest, OneLiveClientAtATime)
+{
+    {
+        ShmChannel client = ShmChannel::open(name_);
+        EXPECT_THROW(ShmChannel::open(name_), std::runtime_error);
+    }
+    EXPECT_NO_THROW(ShmChannel::open(name_));
+}
+
+TEST_F(ShmChannelTest, ReplacesAClientThatDiedAttached)
+{
+    // The child attaches, sends a request and exits without detaching.
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        ShmChannel client = ShmChannel::open(name_);
+        client.send_request("stale");
+        _exit(0);
+    }
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+
+    ShmChannel client = ShmChannel::open(name_);
+    client.send_request("fresh");
+    std::string message;
+    for (int i = 0; i < 2; ++i)
+    {
+        ASSERT_TRUE(service_.receive_request(message));
+        service_.send_response("re: " + message);
+    }
+    ASSERT_TRUE(client.receive_response(message));
+    EXPECT_EQ(message, "re: fresh");
+}
+
+TEST_F(ShmChannelTest, RejectsACorruptedRecord)
+{
+    ShmChannel client = ShmChannel::open(name_);
+    client.send_request("CORRUPT-ME");
+
+    // Overwrite the record's length field through a second mapping.
+    int fd = shm_open(name_.c_str(), O_RDWR, 0);
+    ASSERT_GE(fd, 0);
+    struct stat st;
+    ASSERT_EQ(fstat(fd, &st), 0);
+    void *p = mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    ASSERT_NE(p, MAP_FAILED);
+    char *bytes = static_cast<char *>(p);
+    char *payload = static_cast<char *>(memmem(bytes, static_cast<std::size_t>(st.st_size), "CORRUPT-ME", 10));
+    ASSERT_NE(payload, nullptr);
+    std::uint32_t huge = 0xfffffff0u;
+    std::memcpy(payload - 8, &huge, sizeof(huge));
+    munmap(p, static_cast<std::size_t>(st.st_size));
+
+    std::string message;
+    EXPECT_THROW(service_.receive_request(message), std::runtime_error);
+}
+#endif
+
+#ifdef GREET_TRACING
+TEST(TraceTest, ExportsRecordedSpansAsChromeJson)
+{
+    start_tracing();
+    {
+        GREET_TRACE_SCOPE("outer");
+        GREET_TRACE_SCOPE("inner");
+    }
+    std::thread worker([] { GREET_TRACE_SCOPE("worker"); });
+    worker.join();
+
+    std::string path = "greet_trace_test.json";
+    write_chrome_trace(path);
+    std::FILE *in = std::fopen(path.c_str(), "r");
+    ASSERT_NE(in, nullptr);
+    std::string json = read_back(in);
+    std::fclose(in);
+    std::remove(path.c_str());
+
+    EXPECT_EQ(json.rfind("{\"displayTimeUnit\"", 0), 0u);
+    EXPECT_NE(json.find("\"name\": \"outer\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\": \"inner\""), std::string::npos);
+    EXPECT_NE(json.find("\"name\": \"worker\""), std::string::npos);
+    EXPECT_NE(json.find("\"ph\": \"X\""), std::string::npos);
+}
+#endif